@@ -1,4 +1,5 @@
 #include "../src/campus/campus.h"
+#include "../src/campus/analyzer.h"
 #include <iostream>
 #include <vector>
 #include <cstdlib>
@@ -16,11 +17,36 @@
 
 DEFINE_string(dataset_type, "siftsmall", "Dataset type (siftsmall, sift, gist)");
 DEFINE_int32(initial_num, 1000, "Initial number of vectors");
+DEFINE_bool(bulk_build, false, "Build the initial index with Campus::bulkBuild instead of single inserts");
+DEFINE_int32(bulk_build_threads, -1, "Threads of the bulk build (-1: all cores)");
 // parameters for Campus index itself
 DEFINE_int32(posting_limit, 100, "Posting limit");
 DEFINE_int32(connection_limit, 10, "Connection limit");
+DEFINE_double(prune_alpha, 1.2, "Diversity factor of neighbor pruning (0: nearest only)");
+DEFINE_int32(replica_num, 0, "Max replicas of a vector in neighboring postings (0: off)");
+DEFINE_double(replica_epsilon, 0.1, "Replicate into postings within (1+epsilon) of the primary's distance");
+DEFINE_int32(entry_point_num, 8, "Number of medoid entry points for graph search");
+DEFINE_int32(entry_refresh_interval, 1000, "Commits between entry point refreshes");
 
 DEFINE_int32(insert_threads, 1, "Number of threads for insertion");
+DEFINE_string(insert_search, "exact", "Insert routing (exact, graph, hierarchical)");
+DEFINE_int32(routing_beam_width, 10, "Beam width of graph insert routing");
+DEFINE_bool(routing_exact_fallback, false, "Confirm graph-routed splits with an exact scan");
+DEFINE_int32(routing_audit_interval, 0, "Audit every n-th graph-routed insert against an exact scan (0: off)");
+
+DEFINE_bool(id_index, false, "Keep an id -> node index for lookups by id");
+DEFINE_int32(upsert_num, 0, "Upsert vectors 0..n-1 again after the inserts (enables id_index)");
+DEFINE_int32(delete_num, 0, "Delete vectors 0..n-1 after the inserts");
+DEFINE_int32(compaction_interval, 0, "Milliseconds between background compaction passes (0: one pass after the deletes)");
+DEFINE_double(compaction_dead_ratio, 0.0, "Compact postings holding at least this share of deleted entries");
+DEFINE_int32(archive_collect_threshold, 0, "Remove archived nodes from the registry once a commit leaves this many (0: only between phases)");
+DEFINE_double(split_balance, 0.0, "Cap both halves of a split at this multiple of half the vectors (0: off)");
+DEFINE_int32(merge_threshold, 0, "Merge postings with fewer vectors into a neighbor on compaction (0: off)");
+DEFINE_int32(expire_num, 0, "Expire vectors 0..n-1 after the inserts (each vector is stamped with its id)");
+DEFINE_int32(rebalance_interval, 0, "Milliseconds between background rebalancing passes during the inserts (0: off)");
+DEFINE_int32(rebalance_sample, 64, "Nodes sampled per rebalancing pass");
+DEFINE_int32(rebalance_moves, 256, "Maximum vectors moved per rebalancing pass");
+DEFINE_int32(analyzer_threads, -1, "Threads of the index quality report after the inserts (-1: all cores)");
 
 // parameters for search operation
 DEFINE_int32(search_threads, 1, "Number of threads for search");
@@ -28,6 +54,16 @@ DEFINE_bool(delete_archived, true, "Delete archived nodes before search");
 DEFINE_int32(top_k, 100, "Number of top k elements to search");
 DEFINE_int32(node_num, 10, "Number of nodes to search");
 DEFINE_int32(pq_size, 10, "Priority queue size");
+DEFINE_string(query_search, "exact", "Node search of queries (exact, graph, hierarchical)");
+DEFINE_bool(adaptive_probe, false, "Stop scanning postings early with a learned bound (node_num is the upper limit)");
+DEFINE_double(probe_recall_target, 0.95, "Recall target of the adaptive probe bound");
+DEFINE_int32(probe_calibration_interval, 32, "Every n-th adaptive query scans all node_num postings to calibrate");
+DEFINE_int32(search_pool_threads, 0, "Threads shared by queries for parallel scans (0: off)");
+DEFINE_int64(parallel_scan_threshold, 50000, "Estimated distance calculations from which a query scans in parallel");
+DEFINE_int32(query_batch, 0, "Answer queries in batches of this size with shared posting scans (0: one by one)");
+DEFINE_int32(interleave, 0, "Run this many queries interleaved per search thread to overlap cache misses (0: off)");
+DEFINE_int32(prefetch_distance, 4, "Prefetch distance of the scan loops (0: off, -1: calibrate on the first queries)");
+DEFINE_int32(index_probe, 8, "Number of routers probed in the hierarchical centroid index");
 
 DEFINE_string(output_file, "", "Output csv file path");
 
@@ -101,34 +137,72 @@ void insertVectors(int thread_id, int &ready, const bool &start_flag, Campus *ca
         std::this_thread::yield();
     }
 
+    CampusContext context(campus);
     for (int i = start; i < end; ++i) {
-        CampusInsertExecutor insert_executor(campus, static_cast<const void*>(vectors[i].data()), i);
+        CampusInsertExecutor insert_executor(&context, static_cast<const void*>(vectors[i].data()), i, i);
         insert_executor.insert();
     }
 }
 
 // 類似ベクトル検索を行う関数
-void searchVectors(int thread_id, int &ready, const bool &start_flag, Campus *campus, const std::vector<std::vector<float>> &queries, int start, int end, int top_k, std::vector<std::vector<int>> &results) {
+void searchVectors(int thread_id, int &ready, const bool &start_flag, Campus *campus, const std::vector<std::vector<float>> &queries, int start, int end, int top_k, std::vector<std::vector<std::pair<int, float>>> &results) {
     __atomic_store_n(&ready, 1, __ATOMIC_SEQ_CST);
     while (!start_flag) {
         std::this_thread::yield();
     }
 
+    Campus::NodeSearchType query_search_type = Campus::ExactSearch;
+    if (FLAGS_query_search == "graph") {
+        query_search_type = Campus::GraphSearch;
+    } else if (FLAGS_query_search == "hierarchical") {
+        query_search_type = Campus::HierarchicalSearch;
+    }
+    CampusContext context(campus);
+    if (FLAGS_query_batch > 0) {
+        std::vector<const void*> batch;
+        std::vector<std::vector<std::pair<int, float>>> batch_results;
+        for (int i = start; i < end; i += FLAGS_query_batch) {
+            int batch_end = std::min(end, i + FLAGS_query_batch);
+            batch.clear();
+            for (int j = i; j < batch_end; ++j) {
+                batch.push_back(static_cast<const void*>(queries[j].data()));
+            }
+            campus->searchBatch(batch, FLAGS_top_k, &context, FLAGS_node_num, FLAGS_pq_size, query_search_type, batch_results);
+            for (int j = i; j < batch_end; ++j) {
+                results[j].swap(batch_results[j - i]);
+            }
+        }
+        return;
+    }
+    if (FLAGS_interleave > 0) {
+        std::vector<const void*> thread_queries;
+        for (int i = start; i < end; ++i) {
+            thread_queries.push_back(static_cast<const void*>(queries[i].data()));
+        }
+        std::vector<std::vector<std::pair<int, float>>> thread_results;
+        CampusInterleavedQueryExecutor query_executor(&context, thread_queries, FLAGS_top_k, FLAGS_node_num, FLAGS_pq_size,
+            query_search_type, FLAGS_interleave);
+        query_executor.query(thread_results);
+        for (int i = start; i < end; ++i) {
+            results[i].swap(thread_results[i - start]);
+        }
+        return;
+    }
     for (int i = start; i < end; ++i) {
-        CampusQueryExecutor query_executor(campus, static_cast<const void*>(queries[i].data()), FLAGS_top_k, FLAGS_node_num, FLAGS_pq_size);
-        std::vector<int> result = query_executor.query();
-        results[i] = result;
+        CampusQueryExecutor query_executor(&context, static_cast<const void*>(queries[i].data()), FLAGS_top_k, FLAGS_node_num, FLAGS_pq_size,
+            query_search_type, FLAGS_adaptive_probe, FLAGS_search_pool_threads > 0);
+        query_executor.query(results[i]);
     }
 }
 
 // リコールを計算する関数
-float calculateRecall(const std::vector<std::vector<int>> &results, const std::vector<std::vector<int>> &groundtruth) {
+float calculateRecall(const std::vector<std::vector<std::pair<int, float>>> &results, const std::vector<std::vector<int>> &groundtruth) {
     int correct = 0;
     int total = 0;
     for (size_t i = 0; i < results.size(); ++i) {
         std::unordered_set<int> groundtruth_set(groundtruth[i].begin(), groundtruth[i].begin() + results[i].size());
-        for (int id : results[i]) {
-            if (groundtruth_set.find(id) != groundtruth_set.end()) {
+        for (const std::pair<int, float> &entry : results[i]) {
+            if (groundtruth_set.find(entry.first) != groundtruth_set.end()) {
                 ++correct;
             }
         }
@@ -203,10 +277,62 @@ int main(int argc, char *argv[]) {
     int dimension = base_vectors[0].size();
     Campus::DistanceType distance_type = Campus::L2; // または Campus::Angular
     Campus campus(dimension, FLAGS_posting_limit, FLAGS_connection_limit, distance_type, sizeof(float));
+    campus.setPruneAlpha(FLAGS_prune_alpha);
+    campus.setEntryPoints(FLAGS_entry_point_num, FLAGS_entry_refresh_interval);
+    campus.setReplication(FLAGS_replica_num, FLAGS_replica_epsilon);
+    if (FLAGS_prefetch_distance >= 0) {
+        campus.setPrefetchDistance(FLAGS_prefetch_distance);
+    }
+    if (FLAGS_insert_search == "hierarchical" || FLAGS_query_search == "hierarchical") {
+        campus.enableCentroidIndex(FLAGS_index_probe);
+    }
+    if (FLAGS_search_pool_threads > 0) {
+        campus.enableParallelScan(FLAGS_search_pool_threads, FLAGS_parallel_scan_threshold);
+    }
+    if (FLAGS_adaptive_probe) {
+        campus.enableAdaptiveProbe(FLAGS_probe_recall_target, FLAGS_probe_calibration_interval);
+    }
+    if (FLAGS_id_index || FLAGS_upsert_num > 0) {
+        campus.enableIdIndex();
+    }
+    campus.setMergeThreshold(FLAGS_merge_threshold);
+    campus.setSplitBalance(FLAGS_split_balance);
+    campus.setArchiveCollection(FLAGS_archive_collect_threshold);
+    campus.enableCompaction(FLAGS_compaction_interval, FLAGS_compaction_dead_ratio);
+    if (FLAGS_rebalance_interval > 0) {
+        campus.enableRebalancing(FLAGS_rebalance_interval, FLAGS_rebalance_sample, FLAGS_rebalance_moves);
+    }
+    if (FLAGS_insert_search == "graph") {
+        campus.setInsertRouting(Campus::GraphSearch, FLAGS_routing_beam_width, FLAGS_routing_exact_fallback, FLAGS_routing_audit_interval);
+    } else if (FLAGS_insert_search == "hierarchical") {
+        campus.setInsertRouting(Campus::HierarchicalSearch, FLAGS_routing_beam_width, FLAGS_routing_exact_fallback, FLAGS_routing_audit_interval);
+    } else if (FLAGS_insert_search != "exact") {
+        std::cerr << "Invalid insert search: " << FLAGS_insert_search << std::endl;
+        return 1;
+    }
 
-    for (int i = 0; i < FLAGS_initial_num; ++i) {
-        CampusInsertExecutor insert_executor(&campus, static_cast<const void*>(base_vectors[i].data()), i);
-        insert_executor.insert();
+    if (FLAGS_bulk_build) {
+        int initial_num = std::min<int>(FLAGS_initial_num, base_vectors.size());
+        std::vector<const void*> initial_vectors(initial_num);
+        std::vector<int> initial_ids(initial_num);
+        std::vector<long> initial_timestamps(initial_num);
+        for (int i = 0; i < initial_num; ++i) {
+            initial_vectors[i] = base_vectors[i].data();
+            initial_ids[i] = i;
+            initial_timestamps[i] = i;
+        }
+        int bulk_build_threads = FLAGS_bulk_build_threads >= 0 ? FLAGS_bulk_build_threads : std::max<int>(std::thread::hardware_concurrency(), 1) - 1;
+        auto bulk_start_time = std::chrono::high_resolution_clock::now();
+        campus.bulkBuild(initial_vectors, initial_ids, initial_timestamps, bulk_build_threads);
+        std::chrono::duration<double> bulk_elapsed = std::chrono::high_resolution_clock::now() - bulk_start_time;
+        std::cout << "Bulk built " << initial_num << " vectors into " << campus.getNodeNum() << " nodes using "
+                  << bulk_build_threads + 1 << " threads in " << bulk_elapsed.count() << " seconds.\n";
+    } else {
+        CampusContext initial_context(&campus);
+        for (int i = 0; i < FLAGS_initial_num; ++i) {
+            CampusInsertExecutor insert_executor(&initial_context, static_cast<const void*>(base_vectors[i].data()), i, i);
+            insert_executor.insert();
+        }
     }
     campus.deleteAllArchivedNodes();
     int initial_node_num = campus.getNodeNum();
@@ -259,19 +385,99 @@ int main(int argc, char *argv[]) {
     std::cout << "Throughput: " << base_vectors.size() / elapsed.count() << " vectors/second\n";
     std::cout << "Latency: " << elapsed.count() / base_vectors.size() << " seconds/vector\n";
 
-    std::cout << "All vectors: " << campus.countAllVectors() << ": lost vectors: " << campus.countLostVectors() << std::endl;
-    std::cout << "All vectors: " << campus.countAllVectors() << ": viloate vectors: " << campus.countViolateVectors(new L2Distance()) << std::endl;
+    if (FLAGS_archive_collect_threshold > 0) {
+        std::cout << "Collected archived nodes: " << campus.getCollectedNodes() << std::endl;
+    }
+    std::cout << "Reclaimed versions: " << campus.getReclaimedVersions() << std::endl;
+    if (campus.getRebalancer() != nullptr) {
+        std::cout << "Rebalancer: sampled nodes: " << campus.getRebalancer()->getSampledNodes() << ": moved vectors: "
+                  << campus.getRebalancer()->getMovedVectors() << ": skipped nodes: " << campus.getRebalancer()->getSkippedNodes() << std::endl;
+    }
+    if (campus.getRoutingAudits() > 0) {
+        std::cout << "Routing audits: " << campus.getRoutingAudits() << ": misroutes: " << campus.getRoutingMisroutes() << std::endl;
+    }
+    int analyzer_threads = FLAGS_analyzer_threads >= 0 ? FLAGS_analyzer_threads : std::max<int>(std::thread::hardware_concurrency(), 1) - 1;
+    auto analyze_start_time = std::chrono::high_resolution_clock::now();
+    CampusReport report = CampusAnalyzer(&campus, analyzer_threads).analyze();
+    std::chrono::duration<double> analyze_elapsed = std::chrono::high_resolution_clock::now() - analyze_start_time;
+    report.print(std::cout);
+    std::cout << "Analyzed the index using " << analyzer_threads + 1 << " threads in " << analyze_elapsed.count() << " seconds.\n";
 
     ofs.open(output_file, std::ios::app);
     ofs << initial_node_num << "," << base_vectors.size() / elapsed.count() << "," << elapsed.count() / base_vectors.size() << ","
-        << campus.countAllVectors() << "," << campus.countUniqueVectors() << "," << campus.countViolateVectors(new L2Distance()) << ",";
+        << report.vector_num << "," << report.unique_num << "," << report.violate_num << ",";
     ofs.flush();
     ofs.close();
 
+    if (FLAGS_id_index) {
+        std::vector<float> vector(dimension);
+        int found = 0;
+        auto lookup_start_time = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < base_vectors.size(); ++i) {
+            found += campus.getVector(i, vector.data());
+        }
+        std::chrono::duration<double> lookup_elapsed = std::chrono::high_resolution_clock::now() - lookup_start_time;
+        std::cout << "Looked up " << found << " vectors by id in " << lookup_elapsed.count() << " seconds.\n";
+    }
+
+    if (FLAGS_upsert_num > 0) {
+        int upsert_num = std::min<int>(FLAGS_upsert_num, base_vectors.size());
+        CampusContext upsert_context(&campus);
+        auto upsert_start_time = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < upsert_num; ++i) {
+            CampusUpsertExecutor upsert_executor(&upsert_context, static_cast<const void*>(base_vectors[i].data()), i, i);
+            upsert_executor.upsert();
+        }
+        std::chrono::duration<double> upsert_elapsed = std::chrono::high_resolution_clock::now() - upsert_start_time;
+        std::cout << "Upserted " << upsert_num << " vectors in " << upsert_elapsed.count() << " seconds: lost vectors: "
+                  << campus.countLostVectors() << std::endl;
+    }
+
+    if (FLAGS_delete_num > 0) {
+        // recall below is still measured against the ground truth of all vectors
+        int delete_num = std::min<int>(FLAGS_delete_num, base_vectors.size());
+        CampusContext delete_context(&campus);
+        auto delete_start_time = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < delete_num; ++i) {
+            CampusDeleteExecutor delete_executor(&delete_context, i);
+            delete_executor.remove();
+        }
+        std::chrono::duration<double> delete_elapsed = std::chrono::high_resolution_clock::now() - delete_start_time;
+        std::cout << "Deleted " << delete_num << " vectors in " << delete_elapsed.count() << " seconds.\n";
+        if (FLAGS_compaction_interval == 0) {
+            campus.getCompactor()->compact();
+        }
+        std::cout << "Compacted entries: " << campus.getCompactor()->getRemovedEntities() << " in "
+                  << campus.getCompactor()->getCompactedVersions() << " versions, merged nodes: "
+                  << campus.getCompactor()->getMergedNodes() << std::endl;
+    }
+
+    if (FLAGS_expire_num > 0) {
+        // recall below is still measured against the ground truth of all vectors
+        auto expire_start_time = std::chrono::high_resolution_clock::now();
+        campus.expireBefore(FLAGS_expire_num);
+        if (FLAGS_compaction_interval == 0) {
+            campus.getCompactor()->compact();
+        }
+        std::chrono::duration<double> expire_elapsed = std::chrono::high_resolution_clock::now() - expire_start_time;
+        std::cout << "Expired vectors before " << FLAGS_expire_num << " in " << expire_elapsed.count() << " seconds: retired nodes: "
+                  << campus.getCompactor()->getRetiredNodes() << ", compacted entries: "
+                  << campus.getCompactor()->getRemovedEntities() << std::endl;
+    }
+
     // campus.verifyClusterAssignments(new L2Distance());
     if (FLAGS_delete_archived) {
         campus.deleteAllArchivedNodes();
     }
+    if (FLAGS_prefetch_distance < 0) {
+        CampusContext calibration_context(&campus);
+        std::vector<const void*> calibration_queries;
+        for (size_t i = 0; i < std::min<size_t>(query_vectors.size(), 100); ++i) {
+            calibration_queries.push_back(static_cast<const void*>(query_vectors[i].data()));
+        }
+        int prefetch_distance = campus.calibratePrefetchDistance(&calibration_context, calibration_queries, FLAGS_top_k, FLAGS_node_num);
+        std::cout << "Prefetch distance: " << prefetch_distance << std::endl;
+    }
 
     readys.clear();
     readys.resize(FLAGS_search_threads);
@@ -279,7 +485,7 @@ int main(int argc, char *argv[]) {
     __atomic_store_n(&start_flag, false, __ATOMIC_SEQ_CST);
 
     // 類似ベクトル検索をマルチスレッドで行う
-    std::vector<std::vector<int>> results(query_vectors.size());
+    std::vector<std::vector<std::pair<int, float>>> results(query_vectors.size());
     start_time = std::chrono::high_resolution_clock::now();
 
     std::vector<std::thread> search_threads;
@@ -320,6 +526,9 @@ int main(int argc, char *argv[]) {
               << elapsed.count() << " seconds.\n";
     std::cout << "Throughput: " << query_vectors.size() / elapsed.count() << " queries/second\n";
     std::cout << "Latency: " << elapsed.count() / query_vectors.size() << " seconds/query\n";
+    if (campus.getProbedQueries() > 0) {
+        std::cout << "Probed postings: " << static_cast<double>(campus.getProbedPostings()) / campus.getProbedQueries() << " per query\n";
+    }
 
     // リコールを計算
     float recall = calculateRecall(results, groundtruth);
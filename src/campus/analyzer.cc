@@ -0,0 +1,216 @@
+#include "analyzer.h"
+#include "campus.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+
+void CampusReport::print(std::ostream &os) const {
+    os << "Live nodes: " << node_num << ": vectors: " << vector_num << ": unique: " << unique_num
+       << ": lost: " << lost_num << ": replicas: " << replica_num << std::endl;
+    os << "Violate vectors: " << violate_num << " (" << getViolationRate() * 100 << "%)" << std::endl;
+    os << "Posting size: min " << min_posting << ": max " << max_posting << ": histogram";
+    for (size_t bucket = 0; bucket < posting_histogram.size(); ++bucket) {
+        os << " [" << bucket * histogram_width << "," << (bucket + 1) * histogram_width << "):" << posting_histogram[bucket];
+    }
+    os << std::endl;
+    os << "Out degree: min " << min_out_degree << ": max " << max_out_degree << ": mean " << mean_out_degree
+       << ": in degree: min " << min_in_degree << ": max " << max_in_degree << std::endl;
+    os << "Stale edges: " << stale_edges << ": broken edges: " << broken_edges << ": unreachable nodes: " << unreachable_num << std::endl;
+}
+
+CampusAnalyzer::CampusAnalyzer(Campus *campus, int thread_num) : campus_(campus), pool_(thread_num) {
+    for (int worker = 0; worker < pool_.getWorkerNum(); ++worker) {
+        contexts_.push_back(new CampusContext(campus));
+    }
+}
+
+CampusAnalyzer::~CampusAnalyzer() {
+    for (CampusContext *context : contexts_) {
+        delete context;
+    }
+}
+
+namespace {
+// per-worker part of the report, merged at the end
+struct WorkerReport {
+    long vector_num = 0;
+    long replica_num = 0;
+    long violate_num = 0;
+    long stale_edges = 0;
+    long broken_edges = 0;
+    std::vector<int> ids;
+    std::vector<long> posting_histogram;
+    std::vector<const void*> queries;
+    std::vector<float> distances;
+    std::vector<float> own_distances;
+    std::vector<float> min_distances;
+};
+}
+
+CampusReport CampusAnalyzer::analyze() {
+    // one committed state: the latest versions of the live nodes under the validation lock
+    std::vector<Node*> nodes;
+    std::vector<Version*> versions;
+    // the versions are read until the end of the analysis
+    EpochGuard guard(campus_->getEpochs());
+    while (!campus_->validationLock()) {}
+    std::shared_ptr<std::vector<Node*>> nodes_snapshot = campus_->getNodesSnapshot();
+    // searches start from the nearest live medoid, or from the fallback entry point if none is live
+    std::vector<Node*> entry_points;
+    for (Node *node : *campus_->getEntryPoints()) {
+        if (!node->isArchived()) {
+            entry_points.push_back(node);
+        }
+    }
+    if (entry_points.empty() && campus_->getEntryPoint() != nullptr) {
+        entry_points.push_back(campus_->getEntryPoint());
+    }
+    for (Node *node : *nodes_snapshot) {
+        if (!node->isArchived()) {
+            nodes.push_back(node);
+            versions.push_back(node->getLatestVersion());
+        }
+    }
+    campus_->validationUnlock();
+
+    CampusReport report;
+    report.node_num = nodes.size();
+    if (nodes.empty()) {
+        return report;
+    }
+    std::unordered_map<Node*, int> node_index;
+    for (int i = 0; i < nodes.size(); ++i) {
+        node_index[nodes[i]] = i;
+    }
+    int dimension = campus_->getDimension();
+    size_t vector_size = dimension * campus_->getElementSize();
+    std::vector<char> centroids(nodes.size() * vector_size);
+    for (int i = 0; i < nodes.size(); ++i) {
+        std::memcpy(centroids.data() + i * vector_size, versions[i]->getCentroid(), vector_size);
+    }
+    report.histogram_width = std::max(1, (campus_->getPositingLimit() + 9) / 10);
+    int bucket_num = campus_->getPositingLimit() / report.histogram_width + 1;
+
+    std::vector<WorkerReport> workers(pool_.getWorkerNum());
+    for (WorkerReport &worker : workers) {
+        worker.posting_histogram.assign(bucket_num, 0);
+    }
+    pool_.parallelFor(nodes.size(), [&](int worker_id, int task) {
+        WorkerReport &worker = workers[worker_id];
+        Version *version = versions[task];
+        Entity **posting = version->getPosting();
+        worker.queries.clear();
+        for (int i = 0; i < version->getVectorNum(); ++i) {
+            if (posting[i]->is_replica) {
+                worker.replica_num++;
+                continue;
+            }
+            worker.ids.push_back(posting[i]->id);
+            worker.queries.push_back(posting[i]->getVector());
+        }
+        int query_num = worker.queries.size();
+        worker.vector_num += query_num;
+        worker.posting_histogram[std::min(query_num / report.histogram_width, bucket_num - 1)]++;
+
+        // distances of the primaries to every centroid, one block at a time
+        Distance *distance = contexts_[worker_id]->getDistance();
+        worker.own_distances.assign(query_num, 0);
+        worker.min_distances.assign(query_num, std::numeric_limits<float>::max());
+        for (size_t begin = 0; begin < nodes.size() && query_num > 0; begin += CENTROID_BLOCK) {
+            size_t block_num = std::min<size_t>(CENTROID_BLOCK, nodes.size() - begin);
+            worker.distances.resize(query_num * block_num);
+            distance->calculateDistances(worker.queries.data(), query_num, centroids.data() + begin * vector_size,
+                block_num, dimension, worker.distances.data());
+            for (int q = 0; q < query_num; ++q) {
+                const float *row = worker.distances.data() + q * block_num;
+                for (size_t j = 0; j < block_num; ++j) {
+                    if (begin + j == task) {
+                        worker.own_distances[q] = row[j];
+                    } else if (row[j] < worker.min_distances[q]) {
+                        worker.min_distances[q] = row[j];
+                    }
+                }
+            }
+        }
+        for (int q = 0; q < query_num; ++q) {
+            if (worker.min_distances[q] < worker.own_distances[q]) {
+                worker.violate_num++;
+            }
+        }
+
+        for (Node *neighbor_node : version->getOutNeighbors()) {
+            auto neighbor = node_index.find(neighbor_node);
+            if (neighbor == node_index.end()) {
+                worker.stale_edges++;
+                continue;
+            }
+            const std::vector<Node*> &in_neighbors = versions[neighbor->second]->getInNeighbors();
+            if (std::find(in_neighbors.begin(), in_neighbors.end(), nodes[task]) == in_neighbors.end()) {
+                worker.broken_edges++;
+            }
+        }
+    });
+
+    std::vector<int> ids;
+    report.posting_histogram.assign(bucket_num, 0);
+    for (WorkerReport &worker : workers) {
+        report.vector_num += worker.vector_num;
+        report.replica_num += worker.replica_num;
+        report.violate_num += worker.violate_num;
+        report.stale_edges += worker.stale_edges;
+        report.broken_edges += worker.broken_edges;
+        ids.insert(ids.end(), worker.ids.begin(), worker.ids.end());
+        for (int bucket = 0; bucket < bucket_num; ++bucket) {
+            report.posting_histogram[bucket] += worker.posting_histogram[bucket];
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    report.unique_num = std::unique(ids.begin(), ids.end()) - ids.begin();
+    report.lost_num = report.vector_num - report.unique_num;
+
+    report.min_posting = report.min_out_degree = report.min_in_degree = std::numeric_limits<int>::max();
+    long out_degree_sum = 0;
+    for (Version *version : versions) {
+        report.min_posting = std::min(report.min_posting, version->getPrimaryNum());
+        report.max_posting = std::max(report.max_posting, version->getPrimaryNum());
+        int out_degree = version->getOutNeighbors().size();
+        int in_degree = version->getInNeighbors().size();
+        report.min_out_degree = std::min(report.min_out_degree, out_degree);
+        report.max_out_degree = std::max(report.max_out_degree, out_degree);
+        report.min_in_degree = std::min(report.min_in_degree, in_degree);
+        report.max_in_degree = std::max(report.max_in_degree, in_degree);
+        out_degree_sum += out_degree;
+    }
+    report.mean_out_degree = double(out_degree_sum) / versions.size();
+
+    // reachability along out-edges from the entry points; like the graph search, archived nodes
+    // are passed through with their latest version
+    std::vector<Node*> frontier;
+    VisitedTable &visited = contexts_[0]->getVisitedTable();
+    visited.reset();
+    int reached = 0;
+    for (Node *entry_point : entry_points) {
+        if (visited.visit(entry_point->getSlot())) {
+            frontier.push_back(entry_point);
+        }
+    }
+    while (!frontier.empty()) {
+        Node *node = frontier.back();
+        frontier.pop_back();
+        auto index = node_index.find(node);
+        Version *version = node->getLatestVersion();
+        if (index != node_index.end()) {
+            version = versions[index->second];
+            reached++;
+        }
+        for (Node *neighbor_node : version->getOutNeighbors()) {
+            if (visited.visit(neighbor_node->getSlot())) {
+                frontier.push_back(neighbor_node);
+            }
+        }
+    }
+    report.unreachable_num = nodes.size() - reached;
+    return report;
+}
@@ -0,0 +1,63 @@
+#ifndef CAMPUS_ANALYZER_H
+#define CAMPUS_ANALYZER_H
+
+#include "../utils/thread_pool.h"
+#include <vector>
+#include <ostream>
+
+class Campus;
+class CampusContext;
+
+// Index quality and structure at one point in time. Vectors count primaries unless noted.
+struct CampusReport {
+    int node_num = 0; // live nodes
+    long vector_num = 0;
+    long unique_num = 0;
+    long lost_num = 0; // primaries sharing their id with another primary
+    long replica_num = 0;
+    // primaries closer to another centroid than to their own, as Campus::countViolateVectors()
+    long violate_num = 0;
+    double getViolationRate() const { return vector_num > 0 ? double(violate_num) / vector_num : 0; }
+
+    // primaries per posting; bucket b holds sizes [b * histogram_width, (b + 1) * histogram_width)
+    int min_posting = 0;
+    int max_posting = 0;
+    std::vector<long> posting_histogram;
+    int histogram_width = 1;
+
+    int min_out_degree = 0;
+    int max_out_degree = 0;
+    double mean_out_degree = 0;
+    int min_in_degree = 0;
+    int max_in_degree = 0;
+    long stale_edges = 0; // out-edges to archived nodes
+    long broken_edges = 0; // out-edges to live nodes that do not list the node as an in-neighbor
+    int unreachable_num = 0; // live nodes the graph search cannot reach from the entry point
+
+    void print(std::ostream &os) const;
+};
+
+// Checks the whole index in one pass over a thread pool.
+// The latest versions of the live nodes are taken under the validation lock, so the report
+// describes one committed state even while inserts go on; committed versions never change, so
+// the checks themselves run without the lock. Violations are found with the batched distance
+// kernel: the primaries of a posting are the queries against blocks of all centroids.
+class CampusAnalyzer {
+public:
+    // thread_num pool threads work together with the calling thread.
+    CampusAnalyzer(Campus *campus, int thread_num);
+    ~CampusAnalyzer();
+
+    CampusAnalyzer(const CampusAnalyzer&) = delete;
+    CampusAnalyzer &operator=(const CampusAnalyzer&) = delete;
+
+    CampusReport analyze();
+
+private:
+    static const int CENTROID_BLOCK = 1024; // centroids per distance block, kept in cache
+    Campus *campus_;
+    ThreadPool pool_;
+    std::vector<CampusContext*> contexts_; // one distance per worker
+};
+
+#endif //CAMPUS_ANALYZER_H
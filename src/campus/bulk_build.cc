@@ -0,0 +1,188 @@
+#include "campus.h"
+#include "../utils/kmeans.h"
+#include <algorithm>
+#include <numeric>
+
+namespace {
+// leaves are filled to this share of the posting limit, so inserts find room before the first splits
+const float BULK_FILL_RATIO = 0.8f;
+// children of a k-means split
+const int BULK_BRANCHING = 16;
+const int BULK_KMEANS_ITERATIONS = 10;
+// clusters kept per level by the neighbor search
+const int BULK_BEAM_WIDTH = 8;
+// nearest candidates per connection handed to the pruning
+const int BULK_CANDIDATE_FACTOR = 4;
+
+// cluster of the k-means tree; a leaf becomes a node
+struct BuildCluster {
+    std::vector<float> centroid;
+    std::vector<int> members; // indexes into the dataset, released once the cluster is split
+    std::vector<int> children;
+    Node *node = nullptr;
+};
+}
+
+bool Campus::bulkBuild(const std::vector<const void*> &vectors, const std::vector<int> &ids,
+    const std::vector<long> &timestamps, int thread_num) {
+    if (getNodeNum() != 0) {
+        return false;
+    }
+    // ids and timestamps are read in the parallel loops, so a short one must not get that far
+    if (ids.size() != vectors.size() || (!timestamps.empty() && timestamps.size() != vectors.size())) {
+        return false;
+    }
+    if (vectors.empty()) {
+        return true;
+    }
+    ThreadPool pool(thread_num);
+    CampusContext context(this);
+    Distance *distance = context.getDistance();
+    size_t leaf_size = std::max(1, static_cast<int>(posting_limit_ * BULK_FILL_RATIO));
+
+    // k-means tree, one level at a time; the clusters of a level are split in parallel and each
+    // k-means spreads its assignment steps over the pool as well
+    auto splitCluster = [&](const std::vector<int> &members, std::vector<BuildCluster> &children) {
+        int k = std::min<size_t>(BULK_BRANCHING, (members.size() + leaf_size - 1) / leaf_size);
+        std::vector<const void*> member_vectors(members.size());
+        for (size_t i = 0; i < members.size(); ++i) {
+            member_vectors[i] = vectors[members[i]];
+        }
+        std::vector<float> centers;
+        std::vector<int> labels;
+        // children meant to be leaves are capped like the halves of a split
+        size_t max_size = 0;
+        if (split_balance_ > 0 && members.size() <= BULK_BRANCHING * leaf_size) {
+            max_size = split_balance_ * members.size() / k;
+        }
+        kmeans(member_vectors.data(), members.size(), dimension_, k, BULK_KMEANS_ITERATIONS, members.front() + members.size(),
+            distance, &pool, centers, labels, max_size);
+        children.resize(k);
+        for (int c = 0; c < k; ++c) {
+            children[c].centroid.assign(centers.begin() + c * dimension_, centers.begin() + (c + 1) * dimension_);
+        }
+        for (size_t i = 0; i < members.size(); ++i) {
+            children[labels[i]].members.push_back(members[i]);
+        }
+        children.erase(std::remove_if(children.begin(), children.end(),
+            [](const BuildCluster &child) { return child.members.empty(); }), children.end());
+        if (children.size() < 2) {
+            // identical vectors cannot be separated by distance; cut them by position
+            children.assign(k, BuildCluster());
+            for (int c = 0; c < k; ++c) {
+                children[c].centroid.assign(centers.begin(), centers.begin() + dimension_);
+                children[c].members.assign(members.begin() + members.size() * c / k, members.begin() + members.size() * (c + 1) / k);
+            }
+        }
+    };
+
+    std::vector<BuildCluster> tree(1);
+    tree[0].members.resize(vectors.size());
+    std::iota(tree[0].members.begin(), tree[0].members.end(), 0);
+    std::vector<int> frontier;
+    std::vector<int> leaves;
+    (tree[0].members.size() > leaf_size ? frontier : leaves).push_back(0);
+    while (!frontier.empty()) {
+        std::vector<std::vector<BuildCluster>> children(frontier.size());
+        pool.parallelFor(frontier.size(), [&](int, int task) {
+            splitCluster(tree[frontier[task]].members, children[task]);
+        });
+        std::vector<int> next;
+        for (size_t task = 0; task < frontier.size(); ++task) {
+            for (BuildCluster &child : children[task]) {
+                int child_index = tree.size();
+                tree[frontier[task]].children.push_back(child_index);
+                (child.members.size() > leaf_size ? next : leaves).push_back(child_index);
+                tree.push_back(std::move(child));
+            }
+            std::vector<int>().swap(tree[frontier[task]].members);
+        }
+        frontier.swap(next);
+    }
+
+    std::vector<Node*> nodes(leaves.size());
+    pool.parallelFor(leaves.size(), [&](int, int task) {
+        BuildCluster &leaf = tree[leaves[task]];
+        Node *node = new Node(posting_limit_, dimension_, element_size_, newNodeSlot());
+        Version *version = node->getLatestVersion();
+        for (int member : leaf.members) {
+            version->addVector(vectors[member], ids[member], false, timestamps.empty() ? Entity::NO_TIMESTAMP : timestamps[member]);
+        }
+        const float *centroid = static_cast<const float*>(version->getCentroid());
+        leaf.centroid.assign(centroid, centroid + dimension_);
+        leaf.node = node;
+        nodes[task] = node;
+    });
+
+    // neighbor candidates of a leaf are the leaves met by a beam search down the tree
+    std::vector<std::vector<Node*>> out_neighbors(nodes.size());
+    const std::vector<Version*> no_working_versions;
+    pool.parallelFor(leaves.size(), [&](int, int task) {
+        const float *centroid = tree[leaves[task]].centroid.data();
+        std::vector<std::pair<float, int>> beam(1, std::make_pair(0.0f, 0));
+        std::vector<std::pair<float, int>> next;
+        std::vector<std::pair<float, int>> candidates;
+        while (!beam.empty()) {
+            next.clear();
+            for (const std::pair<float, int> &entry : beam) {
+                for (int child : tree[entry.second].children) {
+                    if (child == leaves[task]) {
+                        continue;
+                    }
+                    float child_distance = distance->calculateDistance(centroid, tree[child].centroid.data(), dimension_);
+                    (tree[child].node != nullptr ? candidates : next).emplace_back(child_distance, child);
+                }
+            }
+            if (next.size() > BULK_BEAM_WIDTH) {
+                std::nth_element(next.begin(), next.begin() + BULK_BEAM_WIDTH, next.end());
+                next.resize(BULK_BEAM_WIDTH);
+            }
+            beam.swap(next);
+        }
+        size_t candidate_num = std::min<size_t>(candidates.size(), connection_limit_ * BULK_CANDIDATE_FACTOR);
+        std::partial_sort(candidates.begin(), candidates.begin() + candidate_num, candidates.end());
+        std::vector<Node*> &neighbors = out_neighbors[task];
+        for (size_t i = 0; i < candidate_num; ++i) {
+            neighbors.push_back(tree[candidates[i].second].node);
+        }
+        std::vector<Node*> dropped;
+        pruneNeighbors(centroid, neighbors, connection_limit_, no_working_versions, distance, dropped);
+    });
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        for (Node *neighbor_node : out_neighbors[i]) {
+            nodes[i]->getLatestVersion()->addOutNeighbor(neighbor_node);
+            neighbor_node->getLatestVersion()->addInNeighbor(nodes[i]);
+        }
+    }
+
+    while (!validationLock()) {}
+    if (node_num_ != 0) {
+        validationUnlock();
+        for (Node *node : nodes) {
+            delete node;
+        }
+        return false;
+    }
+    incrementUpdateCounter();
+    int updater_id = getUpdateCounter();
+    for (Node *node : nodes) {
+        switchVersion(node, node->getLatestVersion());
+        node->getLatestVersion()->setUpdaterId(updater_id);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto new_nodes = std::make_shared<std::vector<Node*>>(*all_nodes_);
+        new_nodes->insert(new_nodes->end(), nodes.begin(), nodes.end());
+        all_nodes_ = new_nodes;
+    }
+    if (centroid_index_ != nullptr) {
+        for (Node *node : nodes) {
+            centroid_index_->addNode(node);
+        }
+    }
+    node_num_ += nodes.size();
+    setEntryPoint(nodes.front());
+    refreshEntryPoints(distance);
+    validationUnlock();
+    return true;
+}
@@ -4,7 +4,9 @@
 #include <limits>
 #include <algorithm>
 #include <iostream>
-#include <unordered_set>
+#include <random>
+#include <chrono>
+#include <thread>
 
 
 Node *Campus::findExactNearestNode(const void *query_vector, Distance *distance) {
@@ -17,7 +19,10 @@ Node *Campus::findExactNearestNode(const void *query_vector, Distance *distance)
         nodes_snapshot = all_nodes_;
     }
 
-    for (Node *node : *nodes_snapshot) {
+    const std::vector<Node*> &nodes = *nodes_snapshot;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        prefetchNodes(nodes.data(), nodes.size(), i, prefetch_distance_, dimension_ * element_size_);
+        Node *node = nodes[i];
         assert(node != nullptr);
         if (node->isArchived()) {
             continue;
@@ -33,6 +38,364 @@ Node *Campus::findExactNearestNode(const void *query_vector, Distance *distance)
     return nearest_node;
 }
 
+void Campus::searchGraph(const void *query_vector, CampusContext *context, int beam_width) {
+    using NodeDistance = std::pair<float, Node*>;
+    // Best-first beam search over the centroid graph.
+    // candidates is a min-heap of nodes to expand, beam a max-heap of the best live nodes so far.
+    // Archived nodes are expanded so that stale edges still lead somewhere, but never enter the beam.
+    auto farther = [](const NodeDistance &a, const NodeDistance &b) { return a.first > b.first; };
+    Distance *distance = context->getDistance();
+    std::vector<NodeDistance> &candidates = context->getSearchCandidates();
+    std::vector<NodeDistance> &beam = context->getNodeHeap();
+    VisitedTable &visited = context->getVisitedTable();
+    candidates.clear();
+    beam.clear();
+    visited.reset();
+
+    Node *entry_point = selectEntryPoint(query_vector, distance);
+    if (entry_point == nullptr || beam_width <= 0) return;
+    float distance_to_entry = distance->calculateDistance(static_cast<const float*>(entry_point->getLatestVersion()->getCentroid()), static_cast<const float*>(query_vector), dimension_);
+    candidates.push_back(std::make_pair(distance_to_entry, entry_point));
+    visited.visit(entry_point->getSlot());
+
+    while (!candidates.empty()) {
+        std::pop_heap(candidates.begin(), candidates.end(), farther);
+        NodeDistance current = candidates.back();
+        candidates.pop_back();
+        if (beam.size() >= beam_width && current.first > beam.front().first) {
+            // every remaining candidate is farther than the worst node in the beam
+            break;
+        }
+        if (!current.second->isArchived()) {
+            beam.push_back(current);
+            std::push_heap(beam.begin(), beam.end());
+            if (beam.size() > beam_width) {
+                std::pop_heap(beam.begin(), beam.end());
+                beam.pop_back();
+            }
+        }
+
+        for (Node *neighbor : current.second->getLatestVersion()->getOutNeighbors()) {
+            assert(neighbor != nullptr);
+            if (!visited.visit(neighbor->getSlot())) {
+                continue;
+            }
+            float distance_to_neighbor = distance->calculateDistance(static_cast<const float*>(neighbor->getLatestVersion()->getCentroid()), static_cast<const float*>(query_vector), dimension_);
+            // candidates are only admitted while they can still enter the beam
+            if (beam.size() < beam_width || distance_to_neighbor < beam.front().first) {
+                candidates.push_back(std::make_pair(distance_to_neighbor, neighbor));
+                std::push_heap(candidates.begin(), candidates.end(), farther);
+            }
+        }
+    }
+}
+
+Node *Campus::selectEntryPoint(const void *query_vector, Distance *distance) {
+    std::shared_ptr<const std::vector<Node*>> entry_points;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entry_points = entry_points_;
+    }
+    Node *entry_point = nullptr;
+    float min_distance = std::numeric_limits<float>::max();
+    for (Node *node : *entry_points) {
+        if (node->isArchived()) {
+            continue;
+        }
+        float current_distance = distance->calculateDistance(node->getLatestVersion()->getCentroid(), query_vector, dimension_);
+        if (current_distance < min_distance) {
+            min_distance = current_distance;
+            entry_point = node;
+        }
+    }
+    return entry_point != nullptr ? entry_point : entry_point_.load();
+}
+
+void Campus::deleteNode(Node *node) {
+    while (!validationLock()) {}
+    bool removed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto new_nodes = std::make_shared<std::vector<Node*>>(*all_nodes_);
+        auto last = std::remove(new_nodes->begin(), new_nodes->end(), node);
+        removed = last != new_nodes->end();
+        new_nodes->erase(last, new_nodes->end());
+        all_nodes_ = new_nodes;
+    }
+    if (removed && node->isArchived()) {
+        archived_in_registry_--;
+        releasePosting(node);
+    }
+    validationUnlock();
+}
+
+int Campus::deleteAllArchivedNodes() {
+    while (!validationLock()) {}
+    int removed_num = collectArchivedNodes();
+    validationUnlock();
+    return removed_num;
+}
+
+int Campus::collectArchivedNodes() {
+    std::vector<Node*> removed_nodes;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto new_nodes = std::make_shared<std::vector<Node*>>();
+        new_nodes->reserve(all_nodes_->size());
+        for (Node *node : *all_nodes_) {
+            (node->isArchived() ? removed_nodes : *new_nodes).push_back(node);
+        }
+        all_nodes_ = new_nodes;
+    }
+    for (Node *node : removed_nodes) {
+        releasePosting(node);
+    }
+    archived_in_registry_ -= removed_nodes.size();
+    collected_nodes_ += removed_nodes.size();
+    return removed_nodes.size();
+}
+
+void Campus::releasePosting(Node *node) {
+    // stale edges may still lead searches through the node, which only need its centroid and
+    // out-edges; the full version is retired like a superseded one
+    Version *final_version = node->getLatestVersion();
+    Version *graph_version = new Version(final_version->getVersion() + 1, node, final_version, 0, dimension_, element_size_);
+    graph_version->copyGraphFromPrevVersion();
+    switchVersion(node, graph_version);
+}
+
+void Campus::afterCommit(const std::vector<Node*> &new_nodes, Distance *distance) {
+    if (archive_collect_threshold_ > 0 && archived_in_registry_.load() >= archive_collect_threshold_) {
+        collectArchivedNodes();
+    }
+    Node *entry_point = entry_point_.load();
+    if ((entry_point == nullptr || entry_point->isArchived()) && !new_nodes.empty()) {
+        entry_point_.store(new_nodes.front());
+    }
+    size_t entry_point_num;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entry_point_num = entry_points_->size();
+    }
+    // refresh eagerly while the index is still smaller than the entry set
+    if (++commits_since_refresh_ >= entry_refresh_interval_
+        || (entry_point_num < entry_point_num_ && !new_nodes.empty())) {
+        refreshEntryPoints(distance);
+        commits_since_refresh_ = 0;
+    }
+}
+
+int Campus::mergeUnderfullNodes(CampusContext *context) {
+    if (merge_threshold_ <= 0) {
+        return 0;
+    }
+    EpochGuard guard(epochs_);
+    int merged_num = 0;
+    std::shared_ptr<std::vector<Node*>> nodes_snapshot = getNodesSnapshot();
+    for (Node *node : *nodes_snapshot) {
+        if (node->isArchived() || node->getLatestVersion()->getPrimaryNum() >= merge_threshold_) {
+            continue;
+        }
+        CampusMergeExecutor merge_executor(context, node);
+        if (merge_executor.merge()) {
+            merged_num++;
+        }
+    }
+    return merged_num;
+}
+
+Version *Campus::findWorkingVersion(Node *node, const std::vector<Version*> &working_versions) {
+    for (Version *working_version : working_versions) {
+        if (working_version->getNode() == node) {
+            return working_version;
+        }
+    }
+    return node->getLatestVersion();
+}
+
+void Campus::pruneNeighbors(const void *base_centroid, std::vector<Node*> &neighbors, int connection_limit,
+    const std::vector<Version*> &working_versions, Distance *distance, std::vector<Node*> &dropped) {
+    // Diversity-aware selection (RNG / alpha pruning) in one pass over the candidates, nearest first.
+    // A candidate is skipped when an already selected neighbor is closer to it than the base is,
+    // up to the factor prune_alpha: alpha * d(selected, candidate) <= d(base, candidate).
+    // Skipped candidates fill the remaining slots nearest first, so the degree stays at the limit.
+    float alpha = prune_alpha_;
+    std::vector<std::pair<float, Node*>> candidates;
+    for (Node* neighbor_node : neighbors) {
+        float candidate_distance = distance->calculateDistance(base_centroid,
+            findWorkingVersion(neighbor_node, working_versions)->getCentroid(), dimension_);
+        candidates.push_back(std::make_pair(candidate_distance, neighbor_node));
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    std::vector<Node*> selected;
+    std::vector<Node*> skipped;
+    for (const std::pair<float, Node*> &candidate : candidates) {
+        if (selected.size() >= connection_limit) {
+            skipped.push_back(candidate.second);
+            continue;
+        }
+        const void *candidate_centroid = findWorkingVersion(candidate.second, working_versions)->getCentroid();
+        bool occluded = false;
+        for (Node* selected_node : selected) {
+            float selected_distance = distance->calculateDistance(candidate_centroid,
+                findWorkingVersion(selected_node, working_versions)->getCentroid(), dimension_);
+            if (alpha * selected_distance <= candidate.first) {
+                occluded = true;
+                break;
+            }
+        }
+        if (occluded) {
+            skipped.push_back(candidate.second);
+        } else {
+            selected.push_back(candidate.second);
+        }
+    }
+    // skipped is still ordered nearest first
+    for (Node* skipped_node : skipped) {
+        if (selected.size() < connection_limit) {
+            selected.push_back(skipped_node);
+        } else {
+            dropped.push_back(skipped_node);
+        }
+    }
+    neighbors = selected;
+}
+
+void Campus::refreshEntryPoints(Distance *distance) {
+    static thread_local std::mt19937 rng(std::random_device{}());
+    std::shared_ptr<std::vector<Node*>> nodes_snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        nodes_snapshot = all_nodes_;
+    }
+    std::vector<Node*> sample;
+    for (Node *node : *nodes_snapshot) {
+        if (!node->isArchived()) {
+            sample.push_back(node);
+        }
+    }
+    // k-means over a bounded sample of centroids, then the member nearest to each center as medoid
+    size_t sample_size = std::min<size_t>(sample.size(), 32 * std::max(entry_point_num_, 1));
+    for (size_t i = 0; i < sample_size; ++i) {
+        std::swap(sample[i], sample[std::uniform_int_distribution<size_t>(i, sample.size() - 1)(rng)]);
+    }
+    sample.resize(sample_size);
+    auto centroidOf = [](Node *node) { return static_cast<const float*>(node->getLatestVersion()->getCentroid()); };
+
+    auto entry_points = std::make_shared<std::vector<Node*>>();
+    if (sample.size() <= entry_point_num_) {
+        *entry_points = sample;
+    } else {
+        // farthest-first seeding spreads the initial centers over the sample
+        std::vector<std::vector<float>> centers;
+        std::vector<float> min_distances(sample.size(), std::numeric_limits<float>::max());
+        size_t next = 0;
+        while (centers.size() < entry_point_num_) {
+            centers.emplace_back(centroidOf(sample[next]), centroidOf(sample[next]) + dimension_);
+            float max_distance = -1;
+            for (size_t i = 0; i < sample.size(); ++i) {
+                min_distances[i] = std::min(min_distances[i],
+                    distance->calculateDistance(centroidOf(sample[i]), centers.back().data(), dimension_));
+                if (min_distances[i] > max_distance) {
+                    max_distance = min_distances[i];
+                    next = i;
+                }
+            }
+        }
+
+        std::vector<int> assignment(sample.size(), 0);
+        for (int iteration = 0; iteration < 5; ++iteration) {
+            for (size_t i = 0; i < sample.size(); ++i) {
+                float min_distance = std::numeric_limits<float>::max();
+                for (int c = 0; c < centers.size(); ++c) {
+                    float current_distance = distance->calculateDistance(centroidOf(sample[i]), centers[c].data(), dimension_);
+                    if (current_distance < min_distance) {
+                        min_distance = current_distance;
+                        assignment[i] = c;
+                    }
+                }
+            }
+            std::vector<int> counts(centers.size(), 0);
+            std::vector<std::vector<float>> sums(centers.size(), std::vector<float>(dimension_, 0));
+            for (size_t i = 0; i < sample.size(); ++i) {
+                const float *centroid = centroidOf(sample[i]);
+                for (int j = 0; j < dimension_; ++j) {
+                    sums[assignment[i]][j] += centroid[j];
+                }
+                counts[assignment[i]]++;
+            }
+            for (int c = 0; c < centers.size(); ++c) {
+                if (counts[c] == 0) {
+                    continue;
+                }
+                for (int j = 0; j < dimension_; ++j) {
+                    centers[c][j] = sums[c][j] / counts[c];
+                }
+            }
+        }
+
+        for (int c = 0; c < centers.size(); ++c) {
+            Node *medoid = nullptr;
+            float min_distance = std::numeric_limits<float>::max();
+            for (size_t i = 0; i < sample.size(); ++i) {
+                if (assignment[i] != c) {
+                    continue;
+                }
+                float current_distance = distance->calculateDistance(centroidOf(sample[i]), centers[c].data(), dimension_);
+                if (current_distance < min_distance) {
+                    min_distance = current_distance;
+                    medoid = sample[i];
+                }
+            }
+            if (medoid != nullptr) {
+                entry_points->push_back(medoid);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    entry_points_ = entry_points;
+}
+
+Node *Campus::findNearestNode(const void *query_vector, CampusContext *context, int beam_width) {
+    searchGraph(query_vector, context, beam_width);
+    std::vector<std::pair<float, Node*>> &beam = context->getNodeHeap();
+    if (beam.empty()) {
+        return nullptr;
+    }
+    return std::min_element(beam.begin(), beam.end())->second;
+}
+
+Node *Campus::routeInsert(const void *insert_vector, CampusContext *context) {
+    Distance *distance = context->getDistance();
+    if (insert_search_type_ == ExactSearch || (insert_search_type_ == HierarchicalSearch && centroid_index_ == nullptr)) {
+        return findExactNearestNode(insert_vector, distance);
+    }
+
+    Node *nearest_node = nullptr;
+    if (insert_search_type_ == HierarchicalSearch) {
+        std::vector<std::pair<float, Node*>> &heap = context->getNodeHeap();
+        centroid_index_->search(insert_vector, distance, 1, index_probe_num_, context->getRouterHeap(), heap);
+        nearest_node = heap.empty() ? nullptr : heap.front().second;
+    } else {
+        nearest_node = findNearestNode(insert_vector, context, routing_beam_width_);
+    }
+    if (routing_audit_interval_ > 0 && routing_counter_.fetch_add(1) % routing_audit_interval_ == 0) {
+        // sampled audit: compare against the exact answer and keep the better one
+        Node *exact_node = findExactNearestNode(insert_vector, distance);
+        routing_audits_++;
+        if (exact_node != nearest_node) {
+            routing_misroutes_++;
+        }
+        return exact_node;
+    }
+    if (nearest_node == nullptr) {
+        return findExactNearestNode(insert_vector, distance);
+    }
+    return nearest_node;
+}
+
 std::vector<Node*> Campus::findExactNearestNodes(const void *query_vector, Distance *distance, int n) {
     std::priority_queue<std::pair<float, Node*>> pq;
     float min_distance = std::numeric_limits<float>::max();
@@ -43,7 +406,10 @@ std::vector<Node*> Campus::findExactNearestNodes(const void *query_vector, Dista
         nodes_snapshot = all_nodes_;
     }
 
-    for (Node *node : *nodes_snapshot) {
+    const std::vector<Node*> &nodes = *nodes_snapshot;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        prefetchNodes(nodes.data(), nodes.size(), i, prefetch_distance_, dimension_ * element_size_);
+        Node *node = nodes[i];
         assert(node != nullptr);
         if (node->isArchived()) {
             continue;
@@ -67,94 +433,537 @@ std::vector<Node*> Campus::findExactNearestNodes(const void *query_vector, Dista
 }
 
 
-std::vector<Node*> Campus::findNearestNodes(const void *query_vector, Distance *distance, int node_num, int pq_size) {
-    using NodeDistance = std::pair<float, Node*>;
-    std::vector<NodeDistance> search_candidates;
-    std::unordered_set<Node*> visited;
+void Campus::findExactNearestNodes(const void *query_vector, CampusContext *context, int n, std::vector<Node*> &result) {
+    Distance *distance = context->getDistance();
+    std::vector<std::pair<float, Node*>> &heap = context->getNodeHeap();
+    heap.clear();
+    result.clear();
+
+    std::shared_ptr<std::vector<Node*>> nodes_snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        nodes_snapshot = all_nodes_;
+    }
+
+    const std::vector<Node*> &nodes = *nodes_snapshot;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        prefetchNodes(nodes.data(), nodes.size(), i, prefetch_distance_, dimension_ * element_size_);
+        Node *node = nodes[i];
+        assert(node != nullptr);
+        if (node->isArchived()) {
+            continue;
+        }
+        Version *latest_version = node->getLatestVersion();
+        float current_distance = distance->calculateDistance(static_cast<const float*>(latest_version->getCentroid()), static_cast<const float*>(query_vector), dimension_);
+
+        if (heap.size() < n) {
+            heap.push_back(std::make_pair(current_distance, node));
+            std::push_heap(heap.begin(), heap.end());
+        } else if (current_distance < heap.front().first) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = std::make_pair(current_distance, node);
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+    // nearest first
+    std::sort_heap(heap.begin(), heap.end());
+    for (const std::pair<float, Node*> &entry : heap) {
+        result.push_back(entry.second);
+    }
+}
+
+
+void Campus::findExactNearestNodesParallel(const void *query_vector, CampusContext *context, int n, std::vector<Node*> &result) {
+    static const int CHUNK_SIZE = 1024;
+    Distance *distance = context->getDistance();
+    std::vector<std::vector<std::pair<float, Node*>>> &worker_heaps = context->getWorkerNodeHeaps();
+    if (worker_heaps.size() < search_pool_->getWorkerNum()) {
+        worker_heaps.resize(search_pool_->getWorkerNum());
+    }
+    for (std::vector<std::pair<float, Node*>> &worker_heap : worker_heaps) {
+        worker_heap.clear();
+    }
+
+    std::shared_ptr<std::vector<Node*>> nodes_snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        nodes_snapshot = all_nodes_;
+    }
+    const std::vector<Node*> &nodes = *nodes_snapshot;
+    int chunk_num = (nodes.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    search_pool_->parallelFor(chunk_num, [&](int worker, int chunk) {
+        std::vector<std::pair<float, Node*>> &heap = worker_heaps[worker];
+        size_t end = std::min(nodes.size(), static_cast<size_t>(chunk + 1) * CHUNK_SIZE);
+        for (size_t i = static_cast<size_t>(chunk) * CHUNK_SIZE; i < end; ++i) {
+            prefetchNodes(nodes.data(), end, i, prefetch_distance_, dimension_ * element_size_);
+            if (nodes[i]->isArchived()) {
+                continue;
+            }
+            float current_distance = distance->calculateDistance(nodes[i]->getLatestVersion()->getCentroid(), query_vector, dimension_);
+            if (heap.size() < n) {
+                heap.push_back(std::make_pair(current_distance, nodes[i]));
+                std::push_heap(heap.begin(), heap.end());
+            } else if (current_distance < heap.front().first) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.back() = std::make_pair(current_distance, nodes[i]);
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+    });
+
+    // merge the per-worker heaps
+    std::vector<std::pair<float, Node*>> &heap = context->getNodeHeap();
+    heap.clear();
+    result.clear();
+    for (const std::vector<std::pair<float, Node*>> &worker_heap : worker_heaps) {
+        for (const std::pair<float, Node*> &entry : worker_heap) {
+            if (heap.size() < n) {
+                heap.push_back(entry);
+                std::push_heap(heap.begin(), heap.end());
+            } else if (entry.first < heap.front().first) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.back() = entry;
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+    }
+    // nearest first
+    std::sort_heap(heap.begin(), heap.end());
+    for (const std::pair<float, Node*> &entry : heap) {
+        result.push_back(entry.second);
+    }
+}
+
+void Campus::scanPostingsParallel(const void *query_vector, int top_k, CampusContext *context, const std::vector<Node*> &nodes) {
+    Distance *distance = context->getDistance();
+    bool dedup = replica_num_ > 0;
+    bool filter_deleted = hasDeadEntries();
+    std::vector<TopKSelector> &worker_selectors = context->getWorkerSelectors();
+    if (worker_selectors.size() < search_pool_->getWorkerNum()) {
+        worker_selectors.resize(search_pool_->getWorkerNum());
+    }
+    for (TopKSelector &worker_selector : worker_selectors) {
+        worker_selector.reset(top_k);
+    }
+
+    // one posting per task; each worker keeps its own top_k
+    search_pool_->parallelFor(nodes.size(), [&](int worker, int task) {
+        TopKSelector &selector = worker_selectors[worker];
+        Version *latest_version = nodes[task]->getLatestVersion();
+        if (filter_deleted && isExpired(latest_version)) {
+            return;
+        }
+        Entity **posting = latest_version->getPosting();
+        for (int i = 0; i < latest_version->getVectorNum(); ++i) {
+            prefetchEntities(posting, latest_version->getVectorNum(), i, prefetch_distance_, dimension_ * element_size_);
+            if (filter_deleted && isDead(posting[i])) {
+                continue;
+            }
+            float entity_distance = distance->calculateDistance(posting[i]->getVector(), query_vector, dimension_);
+            // a replica has the distance of its primary, so only a candidate that would enter can be a duplicate
+            if (!(entity_distance < selector.getThreshold()) || (dedup && selector.contains(posting[i]->id))) {
+                continue;
+            }
+            selector.push(entity_distance, posting[i]->id);
+        }
+    });
+
+    // merge; a replicated id can still come from two workers
+    TopKSelector &selector = context->getSelector();
+    std::vector<std::pair<int, float>> &worker_results = context->getResults();
+    for (TopKSelector &worker_selector : worker_selectors) {
+        worker_selector.finish(worker_results);
+        for (const std::pair<int, float> &entry : worker_results) {
+            if (dedup && selector.contains(entry.first)) {
+                continue;
+            }
+            selector.push(entry.second, entry.first);
+        }
+    }
+}
+
+void Campus::findNearestNodes(const void *query_vector, CampusContext *context, int node_num, int pq_size, std::vector<Node*> &result) {
+    result.clear();
+    searchGraph(query_vector, context, std::max(node_num, pq_size));
+    std::vector<std::pair<float, Node*>> &beam = context->getNodeHeap();
+    // nearest first
+    std::sort_heap(beam.begin(), beam.end());
+    for (int i = 0; i < node_num && i < beam.size(); ++i) {
+        result.push_back(beam[i].second);
+    }
+}
+
+
+void Campus::findIndexedNearestNodes(const void *query_vector, CampusContext *context, int n, std::vector<Node*> &result) {
+    if (centroid_index_ == nullptr) {
+        findExactNearestNodes(query_vector, context, n, result);
+        return;
+    }
+    result.clear();
+    std::vector<std::pair<float, Node*>> &heap = context->getNodeHeap();
+    centroid_index_->search(query_vector, context->getDistance(), n, index_probe_num_, context->getRouterHeap(), heap);
+    // nearest first
+    std::sort_heap(heap.begin(), heap.end());
+    for (const std::pair<float, Node*> &entry : heap) {
+        result.push_back(entry.second);
+    }
+}
+
+void Campus::enableCentroidIndex(int probe_num) {
+    while (!validationLock()) {}
+    if (centroid_index_ == nullptr) {
+        Distance *distance = nullptr;
+        switch (distance_type_) {
+            case L2:
+                distance = new L2Distance();
+                break;
+            case Angular:
+                distance = new AngularDistance();
+                break;
+        }
+        CentroidIndex *centroid_index = new CentroidIndex(dimension_, distance);
+        centroid_index->setPrefetchDistance(prefetch_distance_);
+        for (Node *node : *all_nodes_) {
+            if (!node->isArchived()) {
+                centroid_index->addNode(node);
+            }
+        }
+        centroid_index_ = centroid_index;
+    }
+    index_probe_num_ = probe_num;
+    validationUnlock();
+}
+
 
-    if (entry_point_ == nullptr) return {};
-    float distance_to_entry = distance->calculateDistance(static_cast<const float*>(entry_point_->getLatestVersion()->getCentroid()), static_cast<const float*>(query_vector), dimension_);
-    search_candidates.push_back(std::make_pair(distance_to_entry, entry_point_));
+void Campus::selectNodes(const void *query_vector, CampusContext *context, int node_num, int pq_size, NodeSearchType search_type,
+    bool parallel, std::vector<Node*> &result) {
+    if (search_type == GraphSearch) {
+        findNearestNodes(query_vector, context, node_num, pq_size, result);
+    } else if (search_type == HierarchicalSearch) {
+        findIndexedNearestNodes(query_vector, context, node_num, result);
+    } else if (parallel && countLiveNodes() >= min_parallel_work_) {
+        findExactNearestNodesParallel(query_vector, context, node_num, result);
+    } else {
+        findExactNearestNodes(query_vector, context, node_num, result);
+    }
+}
+
+void Campus::searchBatch(const std::vector<const void*> &queries, int top_k, CampusContext *context, int node_num, int pq_size,
+    NodeSearchType search_type, std::vector<std::vector<std::pair<int, float>>> &results) {
+    EpochGuard guard(epochs_);
+    // route every query first
+    std::vector<std::pair<Node*, int>> &assignments = context->getBatchAssignments();
+    assignments.clear();
+    std::vector<Node*> &nearest_nodes = context->getNearestNodes();
+    for (int q = 0; q < queries.size(); ++q) {
+        selectNodes(queries[q], context, node_num, pq_size, search_type, false, nearest_nodes);
+        for (Node *node : nearest_nodes) {
+            assignments.push_back(std::make_pair(node, q));
+        }
+    }
+    // group the queries by posting
+    std::sort(assignments.begin(), assignments.end(),
+        [](const std::pair<Node*, int> &a, const std::pair<Node*, int> &b) {
+            return a.first->getSlot() != b.first->getSlot() ? a.first->getSlot() < b.first->getSlot() : a.second < b.second;
+        });
+
+    Distance *distance = context->getDistance();
+    bool dedup = replica_num_ > 0;
+    bool filter_deleted = hasDeadEntries();
+    std::vector<TopKSelector> &selectors = context->getBatchSelectors();
+    if (selectors.size() < queries.size()) {
+        selectors.resize(queries.size());
+    }
+    for (size_t q = 0; q < queries.size(); ++q) {
+        selectors[q].reset(top_k);
+    }
+    std::vector<char> &block = context->getBatchBlock();
+    std::vector<int> &ids = context->getBatchIds();
+    std::vector<const void*> &group = context->getBatchGroup();
+    std::vector<float> &distances = context->getBatchDistances();
+    for (size_t begin = 0; begin < assignments.size();) {
+        Node *node = assignments[begin].first;
+        size_t end = begin;
+        group.clear();
+        while (end < assignments.size() && assignments[end].first == node) {
+            group.push_back(queries[assignments[end].second]);
+            end++;
+        }
 
-    while(true) {
-        bool updated = false;
-        for (NodeDistance current : search_candidates) {
-            if (visited.find(current.second) != visited.end()) {
+        // gather the posting into one contiguous block, read once for the whole group
+        // dead entries are left out of the block
+        Version *latest_version = node->getLatestVersion();
+        Entity **posting = latest_version->getPosting();
+        int posting_size = filter_deleted && isExpired(latest_version) ? 0 : latest_version->getVectorNum();
+        size_t vector_size = dimension_ * element_size_;
+        block.resize(posting_size * vector_size);
+        ids.resize(posting_size);
+        int vector_num = 0;
+        for (int i = 0; i < posting_size; ++i) {
+            prefetchEntities(posting, posting_size, i, prefetch_distance_, vector_size);
+            if (filter_deleted && isDead(posting[i])) {
                 continue;
             }
-            visited.insert(current.second);
+            std::memcpy(block.data() + vector_num * vector_size, posting[i]->getVector(), vector_size);
+            ids[vector_num++] = posting[i]->id;
+        }
+        distances.resize(group.size() * vector_num);
+        distance->calculateDistances(group.data(), group.size(), block.data(), vector_num, dimension_, distances.data());
 
-            for (Node *neighbor : current.second->getLatestVersion()->getOutNeighbors()) {
-                assert(neighbor != nullptr);
-                float distance_to_neighbor = distance->calculateDistance(static_cast<const float*>(neighbor->getLatestVersion()->getCentroid()), static_cast<const float*>(query_vector), dimension_);
-                if (visited.find(neighbor) != visited.end()) {
+        for (size_t g = 0; g < group.size(); ++g) {
+            TopKSelector &selector = selectors[assignments[begin + g].second];
+            for (int i = 0; i < vector_num; ++i) {
+                float entity_distance = distances[g * vector_num + i];
+                if (!(entity_distance < selector.getThreshold())) {
                     continue;
                 }
-                // insert neighbor to search_candidates which is sorted by distance
-                if (search_candidates.empty()) {
-                    search_candidates.push_back(std::make_pair(distance_to_neighbor, neighbor));
-                } else {
-                    bool inserted = false;
-                    for (int i = 0; i < search_candidates.size(); ++i) {
-                        if (distance_to_neighbor < search_candidates[i].first) {
-                            search_candidates.insert(search_candidates.begin() + i, std::make_pair(distance_to_neighbor, neighbor));
-                            inserted = true;
-                            break;
-                        }
-                    }
-                    if (!inserted) {
-                        search_candidates.push_back(std::make_pair(distance_to_neighbor, neighbor));
-                    }
-                }
-
-                if (search_candidates.size() > pq_size) {
-                    search_candidates.pop_back(); // 最も類似していない要素を削除
+                if (dedup && selector.contains(ids[i])) {
+                    continue;
                 }
-                updated = true;
+                selector.push(entity_distance, ids[i]);
             }
-            if(updated) break;  
-        }
-        if (!updated) {
-            break;
         }
+        begin = end;
     }
-    std::vector<Node*> result;
-    for (int i = 0; i < node_num && i < node_num; ++i) {
-        result.push_back(search_candidates[i].second);
+    results.resize(queries.size());
+    for (int q = 0; q < queries.size(); ++q) {
+        selectors[q].finish(results[q]);
     }
-    return result;
 }
 
+void Campus::topKSearch(const void *query_vector, int top_k, CampusContext *context, int node_num, int pq_size, NodeSearchType search_type,
+    bool adaptive_probe, bool parallel_scan, std::vector<std::pair<int, float>> &result) {
+    EpochGuard guard(epochs_);
+    Distance *distance = context->getDistance();
+    std::vector<Node*> &nearest_nodes = context->getNearestNodes();
+    bool parallel = parallel_scan && search_pool_ != nullptr;
+    selectNodes(query_vector, context, node_num, pq_size, search_type, parallel, nearest_nodes);
+    TopKSelector &selector = context->getSelector();
+    selector.reset(top_k);
 
-std::vector<int> Campus::topKSearch(const void *query_vector, int top_k, Distance *distance, int node_num, int pq_size) {
-    // std::vector<Node*> nearest_nodes = findNearestNodes(query_vector, distance, node_num, pq_size);
-    std::vector<Node*> nearest_nodes = findExactNearestNodes(query_vector, distance, node_num);
-    std::priority_queue<std::pair<float, int>> pq;
+    // nearest_nodes is ordered nearest centroid first, so adaptive queries can stop at the first
+    // posting beyond the learned bound. Calibrating queries scan everything and track, in
+    // probe_heap, which posting each result came from.
+    AdaptiveProbeModel *probe_model = adaptive_probe ? probe_model_ : nullptr;
+    bool calibrating = probe_model != nullptr && probe_model->shouldCalibrate();
+    float probe_ratio = probe_model != nullptr && !calibrating ? probe_model->getRatio() : std::numeric_limits<float>::infinity();
+    std::vector<std::pair<float, int>> &probe_heap = context->getProbeHeap();
+    std::vector<float> &centroid_distances = context->getCentroidDistances();
+    probe_heap.clear();
+    centroid_distances.clear();
 
-    for (Node *node : nearest_nodes) {
-        Entity **posting = node->getLatestVersion()->getPosting();
-        for (int i = 0; i < node->getLatestVersion()->getVectorNum(); ++i) {
+    // the same id can be found in several postings when replication is enabled
+    bool dedup = replica_num_ > 0;
+    bool filter_deleted = hasDeadEntries();
+
+    int probed_num = 0;
+    if (parallel && probe_model == nullptr) {
+        long work = 0;
+        for (Node *node : nearest_nodes) {
+            work += node->getLatestVersion()->getVectorNum();
+        }
+        if (work >= min_parallel_work_) {
+            scanPostingsParallel(query_vector, top_k, context, nearest_nodes);
+            probed_num = nearest_nodes.size();
+        }
+    }
+    // sequential scan, skipped when the postings were scanned in parallel
+    for (; probed_num < nearest_nodes.size(); ++probed_num) {
+        // the next postings' version and posting array are requested while this one is scanned
+        if (prefetch_distance_ > 0) {
+            if (probed_num + 2 < nearest_nodes.size()) {
+                prefetchRead(nearest_nodes[probed_num + 2]);
+            }
+            if (probed_num + 1 < nearest_nodes.size()) {
+                Version *next_version = nearest_nodes[probed_num + 1]->getLatestVersion();
+                prefetchRead(next_version);
+                prefetchRead(next_version->getPosting());
+            }
+        }
+        Version *latest_version = nearest_nodes[probed_num]->getLatestVersion();
+        if (probe_model != nullptr) {
+            float centroid_distance = distance->calculateDistance(latest_version->getCentroid(), query_vector, dimension_);
+            if (selector.isFull() && centroid_distance > probe_ratio * selector.getThreshold()) {
+                break;
+            }
+            centroid_distances.push_back(centroid_distance);
+        }
+        if (filter_deleted && isExpired(latest_version)) {
+            continue;
+        }
+        Entity **posting = latest_version->getPosting();
+        for (int i = 0; i < latest_version->getVectorNum(); ++i) {
+            prefetchEntities(posting, latest_version->getVectorNum(), i, prefetch_distance_, dimension_ * element_size_);
+            if (filter_deleted && isDead(posting[i])) {
+                continue;
+            }
             float entity_distance = distance->calculateDistance(static_cast<const void*>(posting[i]->getVector()), static_cast<const void*>(query_vector), dimension_);
-            pq.push(std::make_pair(entity_distance, posting[i]->id));
-            if (pq.size() > top_k) {
-                pq.pop();
+            // a replica has the distance of its primary, so only a candidate that would enter can be a duplicate
+            if (dedup && entity_distance < selector.getThreshold() && selector.contains(posting[i]->id)) {
+                continue;
+            }
+            if (!selector.push(entity_distance, posting[i]->id) || !calibrating) {
+                continue;
+            }
+            // probe_heap keeps the same top_k distances as the selector
+            if (probe_heap.size() < top_k) {
+                probe_heap.push_back(std::make_pair(entity_distance, probed_num));
+                std::push_heap(probe_heap.begin(), probe_heap.end());
+            } else if (entity_distance < probe_heap.front().first) {
+                std::pop_heap(probe_heap.begin(), probe_heap.end());
+                probe_heap.back() = std::make_pair(entity_distance, probed_num);
+                std::push_heap(probe_heap.begin(), probe_heap.end());
             }
         }
     }
-
-    std::vector<int> result;
-    while (!pq.empty()) {
-        result.push_back(pq.top().second);
-        pq.pop();
+    // shared counters, so only adaptive queries pay for them
+    if (probe_model != nullptr) {
+        probed_queries_++;
+        probed_postings_ += probed_num;
     }
 
-    std::reverse(result.begin(), result.end());
-    return result;
+    // nearest first
+    selector.finish(result);
+
+    if (calibrating && result.size() >= top_k && result.back().second > 0) {
+        float kth_distance = result.back().second;
+        std::vector<float> &samples = context->getProbeSamples();
+        samples.clear();
+        for (const std::pair<float, int> &entry : probe_heap) {
+            samples.push_back(centroid_distances[entry.second] / kth_distance);
+        }
+        probe_model->addSamples(samples);
+    }
 }
 
 
+int Campus::calibratePrefetchDistance(CampusContext *context, const std::vector<const void*> &queries, int top_k, int node_num) {
+    static const int CANDIDATES[] = {0, 1, 2, 4, 8, 16};
+    std::vector<double> best_times(sizeof(CANDIDATES) / sizeof(CANDIDATES[0]), std::numeric_limits<double>::max());
+    std::vector<std::pair<int, float>> result;
+    // the best of a few rounds, so that one noisy run does not decide
+    for (int round = 0; round < 3; ++round) {
+        for (int c = 0; c < best_times.size(); ++c) {
+            prefetch_distance_ = CANDIDATES[c];
+            auto start_time = std::chrono::steady_clock::now();
+            for (const void *query_vector : queries) {
+                context->reset();
+                topKSearch(query_vector, top_k, context, node_num, node_num, ExactSearch, false, false, result);
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+            best_times[c] = std::min(best_times[c], elapsed.count());
+        }
+    }
+    int best = std::min_element(best_times.begin(), best_times.end()) - best_times.begin();
+    setPrefetchDistance(CANDIDATES[best]);
+    return CANDIDATES[best];
+}
+
 void Campus::switchVersion(Node *node, Version *new_version) {
+    Version *old_version = node->getLatestVersion();
     node->switchVersion(new_version);
+    if (old_version != new_version) {
+        // operations that started before may still read it
+        retired_versions_.push_back(std::make_pair(epochs_.current(), old_version));
+        if (retired_versions_.size() >= RECLAIM_BATCH) {
+            reclaimVersions();
+        }
+    }
+    if (centroid_index_ != nullptr) {
+        centroid_index_->updateNode(node);
+    }
+    if (id_index_ != nullptr) {
+        id_index_->update(new_version);
+    }
+}
+
+void Campus::reclaimVersions() {
+    long safe_epoch = epochs_.advance();
+    size_t reclaimed = 0;
+    while (reclaimed < retired_versions_.size() && retired_versions_[reclaimed].first <= safe_epoch) {
+        delete retired_versions_[reclaimed].second;
+        reclaimed++;
+    }
+    retired_versions_.erase(retired_versions_.begin(), retired_versions_.begin() + reclaimed);
+    reclaimed_versions_ += reclaimed;
+}
+
+void Campus::enableIdIndex() {
+    while (!validationLock()) {}
+    if (id_index_ == nullptr) {
+        id_index_ = new IdIndex();
+        for (Node *node : *getNodesSnapshot()) {
+            if (!node->isArchived()) {
+                id_index_->updateAll(node->getLatestVersion());
+            }
+        }
+    }
+    validationUnlock();
+}
+
+Version *Campus::locateVersion(int vector_id, int &index) {
+    if (tombstones_.contains(vector_id)) {
+        return nullptr;
+    }
+    if (id_index_ == nullptr) {
+        for (Node *node : *getNodesSnapshot()) {
+            if (node->isArchived()) {
+                continue;
+            }
+            Version *latest_version = node->getLatestVersion();
+            for (int i = 0; i < latest_version->getVectorNum(); ++i) {
+                Entity *entity = latest_version->getPosting()[i];
+                if (entity->id == vector_id && !entity->is_replica) {
+                    index = i;
+                    return isExpired(entity) ? nullptr : latest_version;
+                }
+            }
+        }
+        return nullptr;
+    }
+    // A commit switches a version before it updates the index, so a location that has just
+    // gone stale is looked up again.
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        IdIndex::Location location;
+        if (!id_index_->find(vector_id, location)) {
+            return nullptr;
+        }
+        if (!location.node->isArchived()) {
+            Version *latest_version = location.node->getLatestVersion();
+            Entity **posting = latest_version->getPosting();
+            if (location.index < latest_version->getVectorNum() && posting[location.index]->id == vector_id
+                && !posting[location.index]->is_replica) {
+                index = location.index;
+                return isExpired(posting[index]) ? nullptr : latest_version;
+            }
+            for (int i = 0; i < latest_version->getVectorNum(); ++i) {
+                if (posting[i]->id == vector_id && !posting[i]->is_replica) {
+                    index = i;
+                    return isExpired(posting[index]) ? nullptr : latest_version;
+                }
+            }
+        }
+        std::this_thread::yield();
+    }
+    return nullptr;
+}
+
+Node *Campus::locateVector(int vector_id, int &index) {
+    EpochGuard guard(epochs_);
+    Version *version = locateVersion(vector_id, index);
+    return version != nullptr ? version->getNode() : nullptr;
+}
+
+bool Campus::getVector(int vector_id, void *vector) {
+    EpochGuard guard(epochs_);
+    int index;
+    Version *version = locateVersion(vector_id, index);
+    if (version == nullptr) {
+        return false;
+    }
+    // committed versions are never modified, so the entity can be read even if the node has moved on
+    std::memcpy(vector, version->getPosting()[index]->getVector(), dimension_ * element_size_);
+    return true;
 }
 
 bool Campus::verifyClusterAssignments(Distance *distance) {
@@ -167,6 +976,9 @@ bool Campus::verifyClusterAssignments(Distance *distance) {
 
         Entity **posting = node->getLatestVersion()->getPosting();
         for (int i = 0; i < node->getLatestVersion()->getVectorNum(); ++i) {
+            if (posting[i]->is_replica) {
+                continue;
+            }
             float assigned_distance = distance->calculateDistance(static_cast<const float*>(posting[i]->getVector()), static_cast<const float*>(node->getLatestVersion()->getCentroid()), dimension_);
             float min_distance = std::numeric_limits<float>::max();
             for (Node *other_node : *all_nodes_){
@@ -204,9 +1016,15 @@ int Campus::countViolateVectors(Distance *distance) {
 
         Entity **posting = node->getLatestVersion()->getPosting();
         for (int i = 0; i < node->getLatestVersion()->getVectorNum(); ++i) {
+            if (posting[i]->is_replica) {
+                continue;
+            }
             float assigned_distance = distance->calculateDistance(static_cast<const float*>(posting[i]->getVector()), static_cast<const float*>(node->getLatestVersion()->getCentroid()), dimension_);
             float min_distance = std::numeric_limits<float>::max();
-            for (Node *other_node : *all_nodes_){
+            const std::vector<Node*> &nodes = *all_nodes_;
+            for (size_t j = 0; j < nodes.size(); ++j) {
+                prefetchNodes(nodes.data(), nodes.size(), j, prefetch_distance_, dimension_ * element_size_);
+                Node *other_node = nodes[j];
                 if (other_node->isArchived()) {
                     continue;
                 }
@@ -2,12 +2,24 @@
 #define CAMPUS_H
 
 #include "node.h"
+#include "context.h"
+#include "centroid_index.h"
+#include "probe_model.h"
+#include "tombstone.h"
+#include "compactor.h"
+#include "rebalancer.h"
+#include "id_index.h"
 #include "../utils/distance.h"
 #include "../utils/lock.h"
+#include "../utils/thread_pool.h"
+#include "../utils/epoch.h"
 #include <vector>
 #include <mutex>
 #include <memory>
+#include <atomic>
+#include <climits>
 #include <unordered_set>
+#include <algorithm>
 
 class Campus {
 public:
@@ -16,12 +28,34 @@ public:
         Angular
     };
 
+    // How a vector is routed to nodes
+    enum NodeSearchType {
+        ExactSearch,       // scan all centroids
+        GraphSearch,       // walk the centroid graph from the nearest entry point
+        HierarchicalSearch // probe the two-level centroid index, see enableCentroidIndex()
+    };
+
     Campus(int dimension, int posting_limit, int connection_limit, DistanceType distance_type, size_t element_size)
         : dimension_(dimension), posting_limit_(posting_limit), connection_limit_(connection_limit), node_num_(0),
-            update_counter_(0), distance_type_(distance_type), element_size_(element_size), entry_point_(nullptr){}
+            update_counter_(0), archived_in_registry_(0), archive_collect_threshold_(0), collected_nodes_(0), distance_type_(distance_type), element_size_(element_size), entry_point_(nullptr),
+            insert_search_type_(ExactSearch), routing_beam_width_(10), routing_exact_fallback_(false),
+            routing_audit_interval_(0), routing_counter_(0), routing_audits_(0), routing_misroutes_(0), slot_counter_(0), centroid_index_(nullptr), index_probe_num_(0), prune_alpha_(1.2f),
+            entry_point_num_(8), entry_refresh_interval_(1000), commits_since_refresh_(0),
+            probe_model_(nullptr), probed_queries_(0), probed_postings_(0), replica_num_(0), replica_epsilon_(0),
+            search_pool_(nullptr), min_parallel_work_(0), prefetch_distance_(4), expire_before_(LONG_MIN), compactor_(nullptr), merge_threshold_(0), split_balance_(0), id_index_(nullptr),
+            rebalancer_(nullptr), reclaimed_versions_(0) {}
 
     ~Campus() {
-
+        // stop the background passes before anything they read goes away
+        delete compactor_;
+        delete rebalancer_;
+        delete centroid_index_;
+        delete probe_model_;
+        delete search_pool_;
+        delete id_index_;
+        for (const std::pair<long, Version*> &retired : retired_versions_) {
+            delete retired.second;
+        }
     }
 
     int getNodeNum() const { return node_num_; }
@@ -32,35 +66,244 @@ public:
     int getConnectionLimit() const { return connection_limit_; }
 
     Node *findExactNearestNode(const void *query_vector, Distance *distance);
+    Node *findNearestNode(const void *query_vector, CampusContext *context, int beam_width);
+    Node *routeInsert(const void *insert_vector, CampusContext *context);
     std::vector<Node*> findExactNearestNodes(const void *query_vector, Distance *distance, int n); // for debug
-    std::vector<Node*> findNearestNodes(const void *query_vector, Distance *distance, int node_num, int pq_size);
-    std::vector<int> topKSearch(const void *query_vector, int top_k, Distance *distance, int node_num, int pq_size);
+    void findExactNearestNodes(const void *query_vector, CampusContext *context, int n, std::vector<Node*> &result);
+    void findNearestNodes(const void *query_vector, CampusContext *context, int node_num, int pq_size, std::vector<Node*> &result);
+    void findIndexedNearestNodes(const void *query_vector, CampusContext *context, int n, std::vector<Node*> &result);
+    // pq_size is the beam width of the graph search; it is raised to node_num if smaller.
+    // With adaptive_probe, node_num is only the upper bound of scanned postings, see enableAdaptiveProbe().
+    // With parallel_scan, large scans are split over the search pool, see enableParallelScan().
+    // result holds (id, distance) pairs, nearest first.
+    void topKSearch(const void *query_vector, int top_k, CampusContext *context, int node_num, int pq_size, NodeSearchType search_type,
+        bool adaptive_probe, bool parallel_scan, std::vector<std::pair<int, float>> &result);
     DistanceType getDistanceType() const { return distance_type_; }
     bool validationLock() { return validation_lock_.w_trylock(); }
     void validationUnlock() { return validation_lock_.w_unlock(); }
+    // Makes new_version the latest version of node. The version it replaces is retired and freed
+    // once every operation that started before has finished, see getEpochs().
     void switchVersion(Node *node, Version *new_version);
-    void setEntryPoint(Node *node) { entry_point_ = node; }
+    // Operations that read versions without the validation lock pin the current epoch for their
+    // duration: executors, queries, getVector() and the background passes do so themselves.
+    EpochManager &getEpochs() { return epochs_; }
+    long getReclaimedVersions() const { return reclaimed_versions_.load(); }
+    void setEntryPoint(Node *node) { entry_point_.store(node); }
+    Node *getEntryPoint() const { return entry_point_.load(); }
+    // the medoids graph searches start from, see setEntryPoints()
+    std::shared_ptr<const std::vector<Node*>> getEntryPoints() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entry_points_;
+    }
+
+    // Graph searches start from the nearest of entry_point_num medoids of a sample of live nodes,
+    // recomputed every refresh_interval commits. entry_point_ is only the fallback while none is live.
+    void setEntryPoints(int entry_point_num, int refresh_interval) {
+        entry_point_num_ = entry_point_num;
+        entry_refresh_interval_ = refresh_interval;
+    }
+    // Must be called with the validation lock held, after a transaction has been committed.
+    void afterCommit(const std::vector<Node*> &new_nodes, Distance *distance);
+
+    // Insert routing. With exact_fallback, a graph-routed insert that would split a node
+    // first confirms the target with an exact scan. Every audit_interval-th routed insert
+    // (0 disables) is also checked against an exact scan to measure misrouting.
+    void setInsertRouting(NodeSearchType search_type, int beam_width, bool exact_fallback, int audit_interval) {
+        insert_search_type_ = search_type;
+        routing_beam_width_ = beam_width;
+        routing_exact_fallback_ = exact_fallback;
+        routing_audit_interval_ = audit_interval;
+    }
+    NodeSearchType getInsertSearchType() const { return insert_search_type_; }
+
+    // Diversity factor of neighbor pruning, compared on the scale of the distance functor.
+    // 1 gives relative-neighborhood pruning, larger values keep more long edges, 0 keeps the nearest only.
+    void setPruneAlpha(float prune_alpha) { prune_alpha_ = prune_alpha; }
+    float getPruneAlpha() const { return prune_alpha_; }
+    // Cut neighbors down to connection_limit with diversity-aware pruning; the others go to dropped.
+    // Centroids are read from the uncommitted working_versions of a transaction where they exist.
+    void pruneNeighbors(const void *base_centroid, std::vector<Node*> &neighbors, int connection_limit,
+        const std::vector<Version*> &working_versions, Distance *distance, std::vector<Node*> &dropped);
+    // The version of node in working_versions, or its latest version.
+    static Version *findWorkingVersion(Node *node, const std::vector<Version*> &working_versions);
+
+    // Boundary replication: an inserted vector is also stored in up to replica_num neighboring
+    // postings whose centroid distance is within (1 + epsilon) of the primary's, on the scale
+    // of the distance functor. Splits replicate vectors near the new boundary into the sibling.
+    // Queries deduplicate ids while replication is enabled. 0 disables.
+    void setReplication(int replica_num, float epsilon) {
+        replica_num_ = replica_num;
+        replica_epsilon_ = epsilon;
+    }
+    int getReplicaNum() const { return replica_num_; }
+    float getReplicaEpsilon() const { return replica_epsilon_; }
+    bool useRoutingExactFallback() const { return routing_exact_fallback_; }
+    long getRoutingAudits() const { return routing_audits_.load(); }
+    long getRoutingMisroutes() const { return routing_misroutes_.load(); }
     void incrementNodeNum() { node_num_++; }
+    int newNodeSlot() { return slot_counter_++; }
     void incrementUpdateCounter() { update_counter_++; }  
-    void addNode(Node *node) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto new_nodes = std::make_shared<std::vector<Node*>>(*all_nodes_);
-        new_nodes->push_back(node);
-        all_nodes_ = new_nodes;
+    // Build the index from a dataset in one pass instead of one insert per vector; the campus
+    // must be empty, and ids and non-empty timestamps must match vectors in size, otherwise
+    // nothing is done and false is returned. Hierarchical k-means cuts
+    // the vectors into postings filled to about 80% of the posting limit, and every node is
+    // connected to the nearest nodes found by a beam search down the k-means tree, pruned like
+    // the edges of a split. Both phases run on thread_num pool threads and the calling thread.
+    // timestamps may be empty (the vectors never expire). No replicas are created.
+    bool bulkBuild(const std::vector<const void*> &vectors, const std::vector<int> &ids,
+        const std::vector<long> &timestamps, int thread_num);
+    // Build the centroid index over the current nodes and keep it updated on every commit.
+    // probe_num routers are scanned per lookup. The index is read without synchronization by
+    // routing, queries and commits, so call before operations start.
+    void enableCentroidIndex(int probe_num);
+    // Let adaptive queries stop scanning postings early, with a bound learned to keep about
+    // recall_target of the results of a full node_num scan. Every calibration_interval-th
+    // adaptive query scans fully to keep the bound up to date. Call before queries start.
+    void enableAdaptiveProbe(float recall_target, int calibration_interval) {
+        if (probe_model_ == nullptr) {
+            probe_model_ = new AdaptiveProbeModel(recall_target, calibration_interval);
+        }
     }
-    void deleteNode(Node *node) {
-        auto new_nodes = std::make_shared<std::vector<Node*>>(*all_nodes_);
-        new_nodes->erase(std::remove(new_nodes->begin(), new_nodes->end(), node), new_nodes->end());
-        all_nodes_ = new_nodes;
+    // Share thread_num threads among queries that opt in with parallel_scan. The exact centroid
+    // scan and the posting scan of such a query run on the pool, together with the calling
+    // thread, once their estimated work reaches min_parallel_work distance calculations.
+    // Adaptive queries keep their posting scan sequential. Call before queries start.
+    void enableParallelScan(int thread_num, long min_parallel_work) {
+        if (search_pool_ == nullptr) {
+            search_pool_ = new ThreadPool(thread_num);
+        }
+        min_parallel_work_ = min_parallel_work;
     }
+    // Answer a batch of queries with shared posting scans. All queries are routed first and grouped
+    // by posting; each selected posting is then gathered once and scored against its whole group
+    // with Distance::calculateDistances. Results are nearest first, as with topKSearch.
+    void searchBatch(const std::vector<const void*> &queries, int top_k, CampusContext *context, int node_num, int pq_size,
+        NodeSearchType search_type, std::vector<std::vector<std::pair<int, float>>> &results);
+    // Items ahead of the current one at which the scan loops prefetch (0 disables), see prefetchNodes().
+    // Call before queries start.
+    void setPrefetchDistance(int prefetch_distance) {
+        prefetch_distance_ = prefetch_distance;
+        if (centroid_index_ != nullptr) {
+            centroid_index_->setPrefetchDistance(prefetch_distance);
+        }
+    }
+    int getPrefetchDistance() const { return prefetch_distance_; }
+    // Time exact searches of the sample queries with a range of prefetch distances, keep the fastest
+    // and return it. Call before queries start.
+    int calibratePrefetchDistance(CampusContext *context, const std::vector<const void*> &queries, int top_k, int node_num);
 
-    void deleteAllArchivedNodes() {
-        all_nodes_->erase(std::remove_if(all_nodes_->begin(), all_nodes_->end(),
-            [](Node *node) {
-                return node->isArchived();
-            }), all_nodes_->end());
+    // Deleted vectors are tombstoned: queries skip them right away, and their entries are dropped
+    // when the compactor or a split rewrites the posting. Ids are not reused after a delete:
+    // inserts and upserts of a deleted id are rejected.
+    bool markDeleted(int vector_id) { return tombstones_.add(vector_id); }
+    bool isDeleted(int vector_id) const { return tombstones_.contains(vector_id); }
+    long getDeletedNum() const { return tombstones_.size(); }
+    const TombstoneTable &getTombstones() const { return tombstones_; }
+    // Entries stamped (CampusInsertExecutor's timestamp) earlier than timestamp expire at once:
+    // queries skip them right away and the compactor drops them like deleted entries. A posting
+    // that has expired as a whole is retired by the compactor without a rewrite. The bound only
+    // moves forward.
+    void expireBefore(long timestamp) {
+        long bound = expire_before_.load();
+        while (bound < timestamp && !expire_before_.compare_exchange_weak(bound, timestamp)) {}
+    }
+    long getExpiryBound() const { return expire_before_.load(); }
+    bool isExpired(const Entity *entity) const { return entity->timestamp < expire_before_.load(std::memory_order_relaxed); }
+    // True if every entry of the version has expired; O(1) through its max timestamp.
+    bool isExpired(const Version *version) const {
+        return version->getVectorNum() > 0 && version->getMaxTimestamp() < expire_before_.load(std::memory_order_relaxed);
+    }
+    bool isDead(const Entity *entity) const { return isExpired(entity) || tombstones_.contains(entity->id); }
+    // False until something is deleted or expired, so scans can skip the checks.
+    bool hasDeadEntries() const { return !tombstones_.empty() || expire_before_.load(std::memory_order_relaxed) != LONG_MIN; }
+    // Create the compactor, which rewrites postings holding at least min_dead_ratio of deleted
+    // entries, and run it every interval_ms in the background (0: only on getCompactor()->compact()).
+    void enableCompaction(int interval_ms, float min_dead_ratio) {
+        if (compactor_ == nullptr) {
+            compactor_ = new CampusCompactor(this, min_dead_ratio);
+        }
+        if (interval_ms > 0) {
+            compactor_->start(std::chrono::milliseconds(interval_ms));
+        }
     }
+    CampusCompactor *getCompactor() const { return compactor_; }
+    // Create the rebalancer, which samples sample_size nodes per pass and moves up to max_moves
+    // misassigned vectors to a closer neighbor, and run it every interval_ms in the background
+    // (0: only on getRebalancer()->rebalance()).
+    void enableRebalancing(int interval_ms, int sample_size, int max_moves) {
+        if (rebalancer_ == nullptr) {
+            rebalancer_ = new CampusRebalancer(this, sample_size, max_moves);
+        }
+        if (interval_ms > 0) {
+            rebalancer_->start(std::chrono::milliseconds(interval_ms));
+        }
+    }
+    CampusRebalancer *getRebalancer() const { return rebalancer_; }
+    // Nodes holding fewer than low_water primaries are folded into a neighbor by
+    // mergeUnderfullNodes(), which the compactor also runs after each pass. 0 disables merging.
+    void setMergeThreshold(int low_water) { merge_threshold_ = low_water; }
+    int getMergeThreshold() const { return merge_threshold_; }
+    // Size-constrained splits: neither half of a split holds more than ratio times half of the
+    // vectors (ratio >= 1, 1: equal halves), so that a lopsided half does not overflow again
+    // right away. The leaves of bulkBuild() are capped the same way. 0 disables the constraint.
+    void setSplitBalance(float ratio) { split_balance_ = ratio; }
+    float getSplitBalance() const { return split_balance_; }
+    // Returns the number of merged nodes.
+    int mergeUnderfullNodes(CampusContext *context);
+    // Keep an id -> node index current on every commit, so that locateVector() and getVector()
+    // do not scan the postings. Indexes the current nodes; call before queries start.
+    void enableIdIndex();
+    IdIndex *getIdIndex() const { return id_index_; }
+    // The node whose latest version holds the primary of vector_id, and its index in the posting,
+    // or nullptr. Deleted vectors are not found.
+    Node *locateVector(int vector_id, int &index);
+    // Copy the vector of vector_id into vector (dimension * element size bytes).
+    bool getVector(int vector_id, void *vector);
 
+    std::shared_ptr<std::vector<Node*>> getNodesSnapshot() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return all_nodes_;
+    }
+    // Adaptive queries and the postings they scanned; other queries are not counted.
+    long getProbedQueries() const { return probed_queries_.load(); }
+    long getProbedPostings() const { return probed_postings_.load(); }
+    void addNode(Node *node) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto new_nodes = std::make_shared<std::vector<Node*>>(*all_nodes_);
+            new_nodes->push_back(node);
+            all_nodes_ = new_nodes;
+        }
+        if (centroid_index_ != nullptr && !node->isArchived()) {
+            centroid_index_->addNode(node);
+        }
+    }
+    // Must be called with the validation lock held.
+    void archiveNode(Node *node) {
+        if (!node->isArchived()) {
+            archived_in_registry_++;
+        }
+        node->setArchived();
+        if (centroid_index_ != nullptr) {
+            centroid_index_->removeNode(node);
+        }
+    }
+    // The registry is copy-on-write, so nodes can be removed while operations run: a reader keeps
+    // scanning the snapshot it took, and the old array is freed with the last of them.
+    // A removed archived node gets a version holding only its centroid and edges, and its final
+    // version, with the posting, is reclaimed like a superseded one. The node itself and that
+    // version stay allocated, since stale edges of committed versions may still lead to them.
+    // Both take the validation lock.
+    void deleteNode(Node *node);
+    // Returns the number of nodes removed.
+    int deleteAllArchivedNodes();
+    // Remove archived nodes from the registry online: once a commit leaves threshold of them in it,
+    // they are removed before the validation lock is released, so scans over the registry never
+    // pass more than threshold archived nodes (0: off, only deleteAllArchivedNodes()).
+    void setArchiveCollection(int threshold) { archive_collect_threshold_ = threshold; }
+    long getCollectedNodes() const { return collected_nodes_.load(); }
+
+    // The counters below consider primaries only; replicas are counted by countReplicaVectors().
     int countLostVectors() {
         std::unordered_set<int> indexed_ids;
         int all_vector_num = 0;
@@ -68,6 +311,9 @@ public:
             if (!node->isArchived()) {
                 Entity **posting = node->getLatestVersion()->getPosting();
                 for (int i = 0; i < node->getLatestVersion()->getVectorNum(); ++i) {
+                    if (posting[i]->is_replica) {
+                        continue;
+                    }
                     all_vector_num++;
                     indexed_ids.insert(posting[i]->id);
                 }
@@ -82,7 +328,9 @@ public:
             if (!node->isArchived()) {
                 Entity **posting = node->getLatestVersion()->getPosting();
                 for (int i = 0; i < node->getLatestVersion()->getVectorNum(); ++i) {
-                    indexed_ids.insert(posting[i]->id);
+                    if (!posting[i]->is_replica) {
+                        indexed_ids.insert(posting[i]->id);
+                    }
                 }
             }
         }
@@ -93,7 +341,17 @@ public:
         int count = 0;
         for (Node *node : *all_nodes_) {
             if (!node->isArchived()) {
-                count += node->getLatestVersion()->getVectorNum();
+                count += node->getLatestVersion()->getPrimaryNum();
+            }
+        }
+        return count;
+    }
+
+    int countReplicaVectors() {
+        int count = 0;
+        for (Node *node : *all_nodes_) {
+            if (!node->isArchived()) {
+                count += node->getLatestVersion()->getVectorNum() - node->getLatestVersion()->getPrimaryNum();
             }
         }
         return count;
@@ -110,47 +368,136 @@ private:
     int update_counter_;
     size_t element_size_;
     Lock validation_lock_;
-    Node *entry_point_;
+    std::atomic<Node*> entry_point_;
     std::mutex mutex_;
     std::shared_ptr<std::vector<Node*>> all_nodes_ = std::make_shared<std::vector<Node*>>();
+    std::atomic<int> archived_in_registry_; // archived nodes still in all_nodes_
+    int archive_collect_threshold_;
+    std::atomic<long> collected_nodes_;
     DistanceType distance_type_;
+    NodeSearchType insert_search_type_;
+    int routing_beam_width_;
+    bool routing_exact_fallback_;
+    int routing_audit_interval_;
+    std::atomic<long> routing_counter_;
+    std::atomic<long> routing_audits_;
+    std::atomic<long> routing_misroutes_;
+    std::atomic<int> slot_counter_;
+    CentroidIndex *centroid_index_; // set by enableCentroidIndex() before operations start
+    int index_probe_num_;
+    float prune_alpha_;
+    int entry_point_num_;
+    int entry_refresh_interval_;
+    int commits_since_refresh_; // guarded by validation_lock_
+    std::shared_ptr<const std::vector<Node*>> entry_points_ = std::make_shared<std::vector<Node*>>();
+    AdaptiveProbeModel *probe_model_;
+    std::atomic<long> probed_queries_;
+    std::atomic<long> probed_postings_;
+    int replica_num_;
+    float replica_epsilon_;
+    ThreadPool *search_pool_;
+    long min_parallel_work_;
+    int prefetch_distance_;
+    TombstoneTable tombstones_;
+    std::atomic<long> expire_before_;
+    CampusCompactor *compactor_;
+    int merge_threshold_;
+    float split_balance_;
+    IdIndex *id_index_; // written under validation_lock_
+    CampusRebalancer *rebalancer_;
+    // superseded versions with the epoch they were retired in, oldest first
+    static const int RECLAIM_BATCH = 64;
+    EpochManager epochs_;
+    std::vector<std::pair<long, Version*>> retired_versions_; // guarded by validation_lock_
+    std::atomic<long> reclaimed_versions_;
+
+    // The latest version holding the primary of vector_id, see locateVector().
+    Version *locateVersion(int vector_id, int &index);
+    void refreshEntryPoints(Distance *distance);
+    // Free the retired versions no pinned operation can reach any more.
+    void reclaimVersions();
+    // deleteAllArchivedNodes() with the validation lock held.
+    int collectArchivedNodes();
+    // Replace the latest version of an archived node removed from the registry by an edge-only one.
+    void releasePosting(Node *node);
+    Node *selectEntryPoint(const void *query_vector, Distance *distance);
+    void selectNodes(const void *query_vector, CampusContext *context, int node_num, int pq_size, NodeSearchType search_type,
+        bool parallel, std::vector<Node*> &result);
+    // Nodes in the registry that are not archived; node_num_ also counts the archived ones.
+    long countLiveNodes() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::max<long>(0, static_cast<long>(all_nodes_->size()) - archived_in_registry_.load());
+    }
+    void findExactNearestNodesParallel(const void *query_vector, CampusContext *context, int n, std::vector<Node*> &result);
+    // Leaves the top_k results of the postings of nodes in context->getSelector().
+    void scanPostingsParallel(const void *query_vector, int top_k, CampusContext *context, const std::vector<Node*> &nodes);
+    // Leaves the best live nodes found from the selected entry point in context->getNodeHeap() as a max-heap.
+    void searchGraph(const void *query_vector, CampusContext *context, int beam_width);
 
 };
 
 class CampusInsertExecutor {
 public:
-    CampusInsertExecutor(Campus *campus, const void *insert_vector, int vector_id)
-        : campus_(campus), insert_vector_(insert_vector), vector_id_(vector_id) {
-        switch (campus_->getDistanceType()) {
-            case Campus::L2:
-                distance_ = new L2Distance();
-                break;
-            case Campus::Angular:
-                distance_ = new AngularDistance();
-                break;
-        }
+    // timestamp: see Campus::expireBefore; the default never expires
+    CampusInsertExecutor(CampusContext *context, const void *insert_vector, int vector_id, long timestamp = Entity::NO_TIMESTAMP)
+        : CampusInsertExecutor(context, insert_vector, vector_id, timestamp, false) {}
+
+    CampusInsertExecutor(Campus *campus, const void *insert_vector, int vector_id, long timestamp = Entity::NO_TIMESTAMP)
+        : CampusInsertExecutor(new CampusContext(campus), insert_vector, vector_id, timestamp, false) {
+        owns_context_ = true;
     }
 
     ~CampusInsertExecutor() {
-        delete distance_;
+        if (owns_context_) {
+            delete context_;
+        }
     }
 
-    void insert();
+    // Returns false, without changes, if vector_id has been deleted; deleted ids are not reused.
+    bool insert();
 
 
 private:
+    friend class CampusUpsertExecutor;
+
+    // With replace, the primary already stored under vector_id is removed in the same transaction.
+    CampusInsertExecutor(CampusContext *context, const void *insert_vector, int vector_id, long timestamp, bool replace)
+        : campus_(context->getCampus()), context_(context), owns_context_(false), distance_(context->getDistance()),
+            insert_vector_(insert_vector), vector_id_(vector_id), timestamp_(timestamp), replace_(replace), changed_versions_(context->getChangedVersions()),
+            new_nodes_(context->getNewNodes()), new_versions_(context->getNewVersions()) {
+        context_->reset();
+    }
+
+    static const int MAX_ASSIGN_ROUNDS = 100;
+    // attempts to find the old entry of a replaced id that keeps moving, see removeOldVector()
+    static const int MAX_REPLACE_RETRIES = 1000;
     Campus *campus_;
+    CampusContext *context_;
+    bool owns_context_;
     Distance *distance_;
     const void *insert_vector_;
     const int vector_id_;
-    std::vector<Version*> changed_versions_;
-    std::vector<Node*> new_nodes_; // Newly created nodes with split
-    std::vector<Version*> new_versions_; // Newly created versions without split
-    void splitCalculation(Version *spliting_version, const void *insert_vector, int vector_id);
+    const long timestamp_;
+    const bool replace_;
+    // buffers borrowed from context_
+    std::vector<Version*> &changed_versions_;
+    std::vector<Node*> &new_nodes_; // Newly created nodes with split
+    std::vector<Version*> &new_versions_; // Newly created versions without split
+    void splitCalculation(Version *spliting_version, const void *insert_vector, int vector_id, long timestamp);
     void assignCalculation(Node *new_node1, Node *new_node2);
+    void balanceCalculation(Node *new_node1, Node *new_node2);
     void reassignCalculation(Version *spliting_version, Node *new_node1, Node *new_node2);
     void connectNeighbors(Version *spliting_version, Node *new_node1, Node *new_node2, int connection_limit);
     void updateNeighbors(Version *spliting_version, Node *new_node1, Node *new_node2, int connection_limit);
+    void pruneNeighbors(const void *base_centroid, std::vector<Node*> &neighbors, int connection_limit, std::vector<Node*> &dropped);
+    Version *findWorkingVersion(Node *node);
+    bool isWorkingVersion(Version *version) const;
+    void addReplicas(Node *primary_node, const void *vector, int vector_id, long timestamp);
+    void addBoundaryReplicas(Node *new_node1, Node *new_node2);
+    // insert(); returns false if the id has been deleted, also meanwhile, or a replaced id could not be located
+    bool execute();
+    bool removeOldVector(Node *nearest_node, bool &replaced_in_place);
+    void removeReplicas(Version *primary_version, int vector_id);
     bool validation();
     void commit();
     void abort();
@@ -173,35 +520,202 @@ private:
     }
 };
 
-class CampusQueryExecutor {
+// Replaces the vector stored under an id, or inserts it if the id is not indexed yet.
+// The old primary and its replicas are removed in the same optimistic transaction that adds the
+// new vector, so the id is never missing or duplicated. When the new vector routes to the node
+// already holding the id, the entry is replaced in place without a split. Enable the id index
+// (Campus::enableIdIndex) to find the old entry without a scan.
+class CampusUpsertExecutor {
 public:
-    CampusQueryExecutor(Campus *campus, const void *query_vector, int top_k, int node_num, int pq_size)
-        : campus_(campus), query_vector_(query_vector), top_k_(top_k) , node_num_(node_num), pq_size_(pq_size) {
-        switch (campus_->getDistanceType()) {
-            case Campus::L2:
-                distance_ = new L2Distance();
-                break;
-            case Campus::Angular:
-                distance_ = new AngularDistance();
-                break;
+    CampusUpsertExecutor(CampusContext *context, const void *upsert_vector, int vector_id, long timestamp = Entity::NO_TIMESTAMP)
+        : campus_(context->getCampus()), vector_id_(vector_id), insert_executor_(context, upsert_vector, vector_id, timestamp, true) {}
+
+    CampusUpsertExecutor(Campus *campus, const void *upsert_vector, int vector_id, long timestamp = Entity::NO_TIMESTAMP)
+        : campus_(campus), vector_id_(vector_id), insert_executor_(new CampusContext(campus), upsert_vector, vector_id, timestamp, true) {
+        insert_executor_.owns_context_ = true;
+    }
+
+    // Returns false, without changes, if the id has been deleted, also by a delete that runs
+    // concurrently; deleted ids are not reused. Also gives up with false if the old entry keeps
+    // being moved by other transactions.
+    bool upsert() {
+        return insert_executor_.execute();
+    }
+
+private:
+    Campus *campus_;
+    const int vector_id_;
+    CampusInsertExecutor insert_executor_;
+};
+
+// Folds the posting of an underfull node into its nearest neighbor and archives the node.
+// The neighbor takes over the in/out edges of the merged node. Like a split, the merge is
+// prepared on new versions and validated under the validation lock; on a conflict merge()
+// gives up, and the next mergeUnderfullNodes() pass tries again.
+class CampusMergeExecutor {
+public:
+    CampusMergeExecutor(CampusContext *context, Node *node)
+        : campus_(context->getCampus()), context_(context), distance_(context->getDistance()), node_(node),
+            changed_versions_(context->getChangedVersions()), new_nodes_(context->getNewNodes()),
+            new_versions_(context->getNewVersions()) {
+        context_->reset();
+    }
+
+    // Returns true if the node was merged. Nodes at or above the merge threshold, unless their
+    // whole posting has expired, and nodes without a neighbor that has room for their posting,
+    // are left alone.
+    bool merge();
+
+private:
+    Campus *campus_;
+    CampusContext *context_;
+    Distance *distance_;
+    Node *node_;
+    // buffers borrowed from context_
+    std::vector<Version*> &changed_versions_;
+    std::vector<Node*> &new_nodes_; // stays empty, merges create no nodes
+    std::vector<Version*> &new_versions_;
+
+    Node *findTarget(Version *merging_version, int moving_num);
+    Version *getWorkingVersion(Node *node);
+    void rewireNeighbors(Version *merging_version, Node *target_node);
+    void pruneOutNeighbors(Version *version);
+    bool validation();
+    void commit(Node *target_node);
+    void abort();
+};
+
+// Deletes a vector by id. Queries stop returning it as soon as remove() returns;
+// see Campus::markDeleted(). A delete is not an MVCC transaction: it sets the tombstone of the
+// id without touching a version, so it never conflicts with an insert or upsert of the id in
+// flight. The delete wins either way, since an entry committed after it is tombstoned as well,
+// and later inserts of the id are rejected. The entries are dropped by the compactor.
+class CampusDeleteExecutor {
+public:
+    CampusDeleteExecutor(CampusContext *context, int vector_id)
+        : campus_(context->getCampus()), vector_id_(vector_id) {}
+
+    CampusDeleteExecutor(Campus *campus, int vector_id)
+        : campus_(campus), vector_id_(vector_id) {}
+
+    // Returns false if the vector was already deleted or the id is negative. With the id index
+    // enabled, an id that is not stored is rejected too, so that it stays free for an insert;
+    // without it, the id is tombstoned unchecked.
+    bool remove() {
+        IdIndex::Location location;
+        if (campus_->getIdIndex() != nullptr && !campus_->getIdIndex()->find(vector_id_, location)) {
+            return false;
         }
+        return campus_->markDeleted(vector_id_);
+    }
+
+private:
+    Campus *campus_;
+    const int vector_id_;
+};
+
+class CampusQueryExecutor {
+public:
+    CampusQueryExecutor(CampusContext *context, const void *query_vector, int top_k, int node_num, int pq_size,
+        Campus::NodeSearchType search_type = Campus::ExactSearch, bool adaptive_probe = false, bool parallel_scan = false)
+        : campus_(context->getCampus()), context_(context), owns_context_(false), query_vector_(query_vector),
+            top_k_(top_k), node_num_(node_num), pq_size_(pq_size), search_type_(search_type), adaptive_probe_(adaptive_probe),
+            parallel_scan_(parallel_scan) {}
+
+    CampusQueryExecutor(Campus *campus, const void *query_vector, int top_k, int node_num, int pq_size,
+        Campus::NodeSearchType search_type = Campus::ExactSearch, bool adaptive_probe = false, bool parallel_scan = false)
+        : CampusQueryExecutor(new CampusContext(campus), query_vector, top_k, node_num, pq_size, search_type, adaptive_probe, parallel_scan) {
+        owns_context_ = true;
     }
 
     ~CampusQueryExecutor() {
-        delete distance_;
+        if (owns_context_) {
+            delete context_;
+        }
     }
 
     std::vector<int> query() {
-        return campus_->topKSearch(query_vector_, top_k_, distance_, node_num_, pq_size_);
+        std::vector<int> result;
+        query(result);
+        return result;
     };
 
+    // Write the result into a caller-owned buffer so that its capacity can be reused.
+    void query(std::vector<int> &result) {
+        std::vector<std::pair<int, float>> &results = context_->getResults();
+        query(results);
+        result.clear();
+        for (const std::pair<int, float> &entry : results) {
+            result.push_back(entry.first);
+        }
+    }
+
+    // (id, distance) pairs, nearest first, e.g. for merging the results of several indexes or reranking.
+    void query(std::vector<std::pair<int, float>> &result) {
+        context_->reset();
+        campus_->topKSearch(query_vector_, top_k_, context_, node_num_, pq_size_, search_type_, adaptive_probe_, parallel_scan_, result);
+    }
+
     private:
         Campus *campus_;
+        CampusContext *context_;
+        bool owns_context_;
         const void *query_vector_;
         const int top_k_;
-        Distance *distance_;
         const int node_num_;
         const int pq_size_;
+        const Campus::NodeSearchType search_type_;
+        const bool adaptive_probe_;
+        const bool parallel_scan_;
+};
+
+// Runs several queries on one thread as hand-rolled state machines.
+// Every step of a query prefetches what the next step dereferences (node, version, posting array,
+// entities, vectors) and then yields to the other queries of the group, so their work overlaps the
+// cache misses. Results are identical to CampusQueryExecutor without the adaptive and parallel options.
+class CampusInterleavedQueryExecutor {
+public:
+    CampusInterleavedQueryExecutor(CampusContext *context, const std::vector<const void*> &query_vectors, int top_k,
+        int node_num, int pq_size, Campus::NodeSearchType search_type = Campus::ExactSearch, int interleave_width = 8)
+        : campus_(context->getCampus()), context_(context), query_vectors_(query_vectors), top_k_(top_k),
+            node_num_(node_num), pq_size_(pq_size), search_type_(search_type), interleave_width_(interleave_width) {}
+
+    // results[i] answers query_vectors[i] with (id, distance) pairs, nearest first.
+    void query(std::vector<std::vector<std::pair<int, float>>> &results);
+
+    private:
+        // items handled per step, e.g. centroids of a group of nodes or entities of a posting
+        static const int GROUP_SIZE = 8;
+
+        struct QueryState {
+            enum Stage { PrefetchNodes, PrefetchVersions, PrefetchPosting, PrefetchEntities, PrefetchVectors, Score, Done };
+            const void *query_vector;
+            Stage stage;
+            bool selecting; // exact centroid scan before the posting scan
+            size_t cursor;
+            int group_size;
+            Node *group_nodes[GROUP_SIZE];
+            Version *group_versions[GROUP_SIZE];
+            Version *version;
+            int entity;
+            std::vector<std::pair<float, Node*>> node_heap;
+            std::vector<Node*> nodes;
+            TopKSelector selector;
+        };
+
+        Campus *campus_;
+        CampusContext *context_;
+        const std::vector<const void*> &query_vectors_;
+        const int top_k_;
+        const int node_num_;
+        const int pq_size_;
+        const Campus::NodeSearchType search_type_;
+        const int interleave_width_;
+        std::shared_ptr<std::vector<Node*>> nodes_snapshot_;
+
+        void start(QueryState &state, const void *query_vector);
+        void step(QueryState &state);
+        void startScan(QueryState &state);
 };
 
-#endif // CAMPUS_H
\ No newline at end of file
+#endif // CAMPUS_H
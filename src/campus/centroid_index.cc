@@ -0,0 +1,243 @@
+#include "centroid_index.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <cassert>
+
+
+CentroidIndex::CentroidIndex(int dimension, Distance *distance, int min_router_size)
+    : dimension_(dimension), min_router_size_(min_router_size), distance_(distance), node_count_(0), prefetch_distance_(0) {}
+
+CentroidIndex::~CentroidIndex() {
+    delete distance_;
+}
+
+std::shared_ptr<const CentroidIndex::RouterList> CentroidIndex::snapshot() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return routers_;
+}
+
+void CentroidIndex::publish(const std::shared_ptr<const RouterList> &routers) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    routers_ = routers;
+}
+
+int CentroidIndex::getRouterNum() {
+    return snapshot()->size();
+}
+
+void CentroidIndex::addNode(Node *node) {
+    const float *centroid = static_cast<const float*>(node->getLatestVersion()->getCentroid());
+    RouterList routers(*snapshot());
+
+    int router_id = 0;
+    if (routers.empty()) {
+        auto router = std::make_shared<Router>();
+        router->centroid.assign(centroid, centroid + dimension_);
+        router->members.push_back(node);
+        routers.push_back(router);
+    } else {
+        float min_distance = std::numeric_limits<float>::max();
+        for (int i = 0; i < routers.size(); ++i) {
+            float distance = distance_->calculateDistance(routers[i]->centroid.data(), centroid, dimension_);
+            if (distance < min_distance) {
+                min_distance = distance;
+                router_id = i;
+            }
+        }
+        auto router = std::make_shared<Router>(*routers[router_id]);
+        router->members.push_back(node);
+        // running mean of the member centroids
+        for (int j = 0; j < dimension_; ++j) {
+            router->centroid[j] += (centroid[j] - router->centroid[j]) / router->members.size();
+        }
+        routers[router_id] = router;
+    }
+    router_of_[node] = Membership{router_id, std::vector<float>(centroid, centroid + dimension_)};
+    node_count_++;
+
+    // keep routers and their member lists both around sqrt(#nodes)
+    size_t split_size = std::max<size_t>(min_router_size_, 2 * std::sqrt(node_count_));
+    if (routers[router_id]->members.size() > split_size) {
+        splitRouter(routers, router_id);
+    }
+    publish(std::make_shared<const RouterList>(std::move(routers)));
+}
+
+void CentroidIndex::removeNode(Node *node) {
+    auto it = router_of_.find(node);
+    if (it == router_of_.end()) {
+        return;
+    }
+    int router_id = it->second.router_id;
+    std::vector<float> centroid = std::move(it->second.centroid);
+    router_of_.erase(it);
+    node_count_--;
+
+    RouterList routers(*snapshot());
+    auto router = std::make_shared<Router>(*routers[router_id]);
+    router->members.erase(std::remove(router->members.begin(), router->members.end(), node), router->members.end());
+    if (router->members.empty()) {
+        // move the last router into the hole
+        routers[router_id] = routers.back();
+        routers.pop_back();
+        if (router_id < routers.size()) {
+            for (Node *member : routers[router_id]->members) {
+                router_of_[member].router_id = router_id;
+            }
+        }
+    } else {
+        // subtract exactly what addNode() or updateNode() added
+        for (int j = 0; j < dimension_; ++j) {
+            router->centroid[j] -= (centroid[j] - router->centroid[j]) / router->members.size();
+        }
+        routers[router_id] = router;
+    }
+    publish(std::make_shared<const RouterList>(std::move(routers)));
+}
+
+void CentroidIndex::updateNode(Node *node) {
+    auto it = router_of_.find(node);
+    if (it == router_of_.end()) {
+        return;
+    }
+    const float *centroid = static_cast<const float*>(node->getLatestVersion()->getCentroid());
+    std::vector<float> &added = it->second.centroid;
+    if (std::equal(added.begin(), added.end(), centroid)) {
+        return;
+    }
+    RouterList routers(*snapshot());
+    auto router = std::make_shared<Router>(*routers[it->second.router_id]);
+    for (int j = 0; j < dimension_; ++j) {
+        router->centroid[j] += (centroid[j] - added[j]) / router->members.size();
+    }
+    added.assign(centroid, centroid + dimension_);
+    routers[it->second.router_id] = router;
+    publish(std::make_shared<const RouterList>(std::move(routers)));
+}
+
+void CentroidIndex::splitRouter(RouterList &routers, int router_id) {
+    const std::vector<Node*> &members = routers[router_id]->members;
+    // the centroids the members contribute, so that the new means match removeNode()
+    auto centroidOf = [this](Node *node) { return static_cast<const float*>(router_of_[node].centroid.data()); };
+
+    // seed with the first member and the member farthest from it
+    std::vector<float> center1(centroidOf(members[0]), centroidOf(members[0]) + dimension_);
+    float max_distance = -1;
+    const float *farthest = centroidOf(members[0]);
+    for (Node *member : members) {
+        float distance = distance_->calculateDistance(center1.data(), centroidOf(member), dimension_);
+        if (distance > max_distance) {
+            max_distance = distance;
+            farthest = centroidOf(member);
+        }
+    }
+    std::vector<float> center2(farthest, farthest + dimension_);
+
+    std::vector<char> assignment(members.size(), 0);
+    for (int iteration = 0; iteration < 5; ++iteration) {
+        bool changed = false;
+        for (int i = 0; i < members.size(); ++i) {
+            const float *centroid = centroidOf(members[i]);
+            char side = distance_->calculateDistance(centroid, center1.data(), dimension_)
+                <= distance_->calculateDistance(centroid, center2.data(), dimension_) ? 0 : 1;
+            if (side != assignment[i]) {
+                assignment[i] = side;
+                changed = true;
+            }
+        }
+        if (!changed && iteration > 0) {
+            break;
+        }
+        std::fill(center1.begin(), center1.end(), 0);
+        std::fill(center2.begin(), center2.end(), 0);
+        int count1 = 0, count2 = 0;
+        for (int i = 0; i < members.size(); ++i) {
+            std::vector<float> &center = assignment[i] == 0 ? center1 : center2;
+            const float *centroid = centroidOf(members[i]);
+            for (int j = 0; j < dimension_; ++j) {
+                center[j] += centroid[j];
+            }
+            (assignment[i] == 0 ? count1 : count2)++;
+        }
+        if (count1 == 0 || count2 == 0) {
+            // degenerate split, fall back to halves
+            for (int i = 0; i < members.size(); ++i) {
+                assignment[i] = i < members.size() / 2 ? 0 : 1;
+            }
+            break;
+        }
+        for (int j = 0; j < dimension_; ++j) {
+            center1[j] /= count1;
+            center2[j] /= count2;
+        }
+    }
+
+    auto router1 = std::make_shared<Router>();
+    auto router2 = std::make_shared<Router>();
+    for (int i = 0; i < members.size(); ++i) {
+        (assignment[i] == 0 ? router1 : router2)->members.push_back(members[i]);
+    }
+    for (auto router : {router1, router2}) {
+        router->centroid.assign(dimension_, 0);
+        for (Node *member : router->members) {
+            const float *centroid = centroidOf(member);
+            for (int j = 0; j < dimension_; ++j) {
+                router->centroid[j] += centroid[j] / router->members.size();
+            }
+        }
+    }
+
+    routers[router_id] = router1;
+    routers.push_back(router2);
+    for (Node *member : router2->members) {
+        router_of_[member].router_id = routers.size() - 1;
+    }
+}
+
+void CentroidIndex::search(const void *query_vector, Distance *distance, int n, int probe_num,
+    std::vector<std::pair<float, int>> &router_heap, std::vector<std::pair<float, Node*>> &node_heap) {
+    router_heap.clear();
+    node_heap.clear();
+    std::shared_ptr<const RouterList> routers = snapshot();
+
+    for (int i = 0; i < routers->size(); ++i) {
+        if (prefetch_distance_ > 0) {
+            if (i + 2 * prefetch_distance_ < routers->size()) {
+                prefetchRead((*routers)[i + 2 * prefetch_distance_].get());
+            }
+            if (i + prefetch_distance_ < routers->size()) {
+                prefetchRange((*routers)[i + prefetch_distance_]->centroid.data(), dimension_ * sizeof(float));
+            }
+        }
+        float current_distance = distance->calculateDistance((*routers)[i]->centroid.data(), query_vector, dimension_);
+        if (router_heap.size() < probe_num) {
+            router_heap.push_back(std::make_pair(current_distance, i));
+            std::push_heap(router_heap.begin(), router_heap.end());
+        } else if (current_distance < router_heap.front().first) {
+            std::pop_heap(router_heap.begin(), router_heap.end());
+            router_heap.back() = std::make_pair(current_distance, i);
+            std::push_heap(router_heap.begin(), router_heap.end());
+        }
+    }
+
+    for (const std::pair<float, int> &router : router_heap) {
+        const std::vector<Node*> &members = (*routers)[router.second]->members;
+        for (size_t i = 0; i < members.size(); ++i) {
+            prefetchNodes(members.data(), members.size(), i, prefetch_distance_, dimension_ * sizeof(float));
+            Node *node = members[i];
+            if (node->isArchived()) {
+                continue;
+            }
+            float current_distance = distance->calculateDistance(node->getLatestVersion()->getCentroid(), query_vector, dimension_);
+            if (node_heap.size() < n) {
+                node_heap.push_back(std::make_pair(current_distance, node));
+                std::push_heap(node_heap.begin(), node_heap.end());
+            } else if (current_distance < node_heap.front().first) {
+                std::pop_heap(node_heap.begin(), node_heap.end());
+                node_heap.back() = std::make_pair(current_distance, node);
+                std::push_heap(node_heap.begin(), node_heap.end());
+            }
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef CAMPUS_CENTROID_INDEX_H
+#define CAMPUS_CENTROID_INDEX_H
+
+#include "node.h"
+#include "../utils/distance.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+// Two-level k-means tree over node centroids.
+// Nodes are grouped under routers, each with the mean centroid of its members. A search
+// scans the routers, then only the members of the probe_num nearest routers, so selecting
+// clusters costs about O(sqrt(#nodes)) distance calculations instead of O(#nodes).
+//
+// Writers (addNode/removeNode/updateNode) must be serialized by the caller; Campus calls them under
+// its validation lock. Readers work on copy-on-write snapshots and never block writers.
+class CentroidIndex {
+public:
+    // Takes ownership of distance.
+    CentroidIndex(int dimension, Distance *distance, int min_router_size = 32);
+    ~CentroidIndex();
+
+    void addNode(Node *node);
+    void removeNode(Node *node);
+    // Move the node's contribution to its router mean to its current centroid; called when a
+    // commit switches the node to a new version. Nodes not in the index are ignored.
+    void updateNode(Node *node);
+    int getRouterNum();
+    void setPrefetchDistance(int prefetch_distance) { prefetch_distance_ = prefetch_distance; }
+
+    // Leaves the n nearest live nodes in node_heap as a max-heap.
+    void search(const void *query_vector, Distance *distance, int n, int probe_num,
+        std::vector<std::pair<float, int>> &router_heap, std::vector<std::pair<float, Node*>> &node_heap);
+
+private:
+    struct Router {
+        std::vector<float> centroid;
+        std::vector<Node*> members;
+    };
+    using RouterList = std::vector<std::shared_ptr<const Router>>;
+
+    const int dimension_;
+    const int min_router_size_;
+    Distance *distance_;
+    int node_count_;
+    int prefetch_distance_;
+    std::mutex mutex_;
+    std::shared_ptr<const RouterList> routers_ = std::make_shared<RouterList>();
+    // the router of a node and the centroid it contributes to the router mean
+    struct Membership {
+        int router_id;
+        std::vector<float> centroid;
+    };
+    std::unordered_map<Node*, Membership> router_of_; // writer-only
+
+    std::shared_ptr<const RouterList> snapshot();
+    void publish(const std::shared_ptr<const RouterList> &routers);
+    void splitRouter(RouterList &routers, int router_id);
+};
+
+#endif //CAMPUS_CENTROID_INDEX_H
@@ -0,0 +1,99 @@
+#include "compactor.h"
+#include "campus.h"
+
+
+CampusCompactor::CampusCompactor(Campus *campus, float min_dead_ratio)
+    : campus_(campus), min_dead_ratio_(min_dead_ratio), removed_entities_(0), compacted_versions_(0), merged_nodes_(0),
+        retired_nodes_(0), worker_(nullptr) {}
+
+CampusCompactor::~CampusCompactor() {
+    delete worker_;
+}
+
+void CampusCompactor::start(std::chrono::milliseconds interval) {
+    if (worker_ == nullptr) {
+        worker_ = new PeriodicWorker(interval, [this] { compact(); });
+    }
+}
+
+long CampusCompactor::compact() {
+    std::lock_guard<std::mutex> lock(pass_mutex_);
+    EpochGuard guard(campus_->getEpochs());
+    long removed = 0;
+    CampusContext context(campus_);
+    if (campus_->hasDeadEntries()) {
+        std::shared_ptr<std::vector<Node*>> nodes_snapshot = campus_->getNodesSnapshot();
+        for (Node *node : *nodes_snapshot) {
+            if (node->isArchived()) {
+                continue;
+            }
+            if (campus_->isExpired(node->getLatestVersion())) {
+                // folded away as a whole, without copying the posting
+                CampusMergeExecutor merge_executor(&context, node);
+                if (merge_executor.merge()) {
+                    retired_nodes_++;
+                }
+                // on a conflict or without a target, retry on the next pass; a rewrite would leave
+                // an empty posting whose centroid falls to the origin
+                continue;
+            }
+            removed += compactNode(node);
+        }
+    }
+    if (campus_->getMergeThreshold() > 0) {
+        merged_nodes_ += campus_->mergeUnderfullNodes(&context);
+    }
+    return removed;
+}
+
+int CampusCompactor::compactNode(Node *node) {
+    Version *latest_version = node->getLatestVersion();
+    Entity **posting = latest_version->getPosting();
+    int dead_num = 0;
+    for (int i = 0; i < latest_version->getVectorNum(); ++i) {
+        if (campus_->isDead(posting[i])) {
+            dead_num++;
+        }
+    }
+    if (dead_num == 0 || dead_num < min_dead_ratio_ * latest_version->getVectorNum()) {
+        return 0;
+    }
+
+    Version *new_version = new Version(latest_version->getVersion() + 1, node, latest_version,
+        campus_->getPositingLimit(), campus_->getDimension(), campus_->getElementSize());
+    new_version->copyFromPrevVersion();
+    int removed = 0;
+    removed_ids_.clear();
+    for (int i = new_version->getVectorNum() - 1; i >= 0; --i) {
+        Entity *entity = new_version->getPosting()[i];
+        if (campus_->isDead(entity)) {
+            if (!entity->is_replica) {
+                removed_ids_.push_back(entity->id);
+            }
+            new_version->deleteEntity(i);
+            removed++;
+        }
+    }
+
+    while (!campus_->validationLock()) {}
+    if (node->isArchived() || node->getLatestVersion() != latest_version) {
+        // changed by a concurrent transaction; retried on the next pass
+        campus_->validationUnlock();
+        delete new_version;
+        return 0;
+    }
+    campus_->incrementUpdateCounter();
+    int updater_id = campus_->getUpdateCounter();
+    campus_->switchVersion(node, new_version);
+    new_version->setUpdaterId(updater_id);
+    if (campus_->getIdIndex() != nullptr) {
+        for (int id : removed_ids_) {
+            campus_->getIdIndex()->erase(id, node);
+        }
+    }
+    campus_->validationUnlock();
+
+    removed_entities_ += removed;
+    compacted_versions_++;
+    return removed;
+}
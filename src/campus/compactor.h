@@ -0,0 +1,53 @@
+#ifndef CAMPUS_COMPACTOR_H
+#define CAMPUS_COMPACTOR_H
+
+#include "../utils/periodic_worker.h"
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <vector>
+
+class Campus;
+class Node;
+
+// Drops deleted and expired vectors from the postings.
+// A pass walks a snapshot of the nodes and gives every live node whose posting holds dead
+// entries (at least min_dead_ratio of it) a new version without them. The version is committed
+// like an insert: validated under the validation lock and dropped if another transaction
+// changed the node in the meantime, in which case the next pass retries.
+// A node whose whole posting has expired is merged away instead (CampusMergeExecutor), which
+// only rewires its edges and never copies the posting.
+// Each pass ends with Campus::mergeUnderfullNodes().
+class CampusCompactor {
+public:
+    CampusCompactor(Campus *campus, float min_dead_ratio);
+    ~CampusCompactor();
+
+    CampusCompactor(const CampusCompactor&) = delete;
+    CampusCompactor &operator=(const CampusCompactor&) = delete;
+
+    // Run a pass every interval on a background thread until the compactor is destroyed.
+    void start(std::chrono::milliseconds interval);
+    // Run one pass on the calling thread. Returns the number of entries removed.
+    long compact();
+
+    long getRemovedEntities() const { return removed_entities_.load(); }
+    long getCompactedVersions() const { return compacted_versions_.load(); }
+    long getMergedNodes() const { return merged_nodes_.load(); }
+    long getRetiredNodes() const { return retired_nodes_.load(); }
+
+private:
+    Campus *campus_;
+    const float min_dead_ratio_;
+    std::atomic<long> removed_entities_;
+    std::atomic<long> compacted_versions_;
+    std::atomic<long> merged_nodes_;
+    std::atomic<long> retired_nodes_; // expired as a whole
+    std::mutex pass_mutex_; // one pass at a time
+    PeriodicWorker *worker_;
+    std::vector<int> removed_ids_; // primaries dropped by the current compactNode()
+
+    int compactNode(Node *node);
+};
+
+#endif //CAMPUS_COMPACTOR_H
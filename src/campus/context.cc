@@ -0,0 +1,34 @@
+#include "context.h"
+#include "campus.h"
+
+
+CampusContext::CampusContext(Campus *campus) : campus_(campus), distance_(nullptr) {
+    switch (campus_->getDistanceType()) {
+        case Campus::L2:
+            distance_ = new L2Distance();
+            break;
+        case Campus::Angular:
+            distance_ = new AngularDistance();
+            break;
+    }
+}
+
+CampusContext::~CampusContext() {
+    delete distance_;
+}
+
+void CampusContext::reset() {
+    node_heap_.clear();
+    search_candidates_.clear();
+    results_.clear();
+    router_heap_.clear();
+    nearest_nodes_.clear();
+    probe_heap_.clear();
+    centroid_distances_.clear();
+    probe_samples_.clear();
+    batch_assignments_.clear();
+    batch_group_.clear();
+    changed_versions_.clear();
+    new_nodes_.clear();
+    new_versions_.clear();
+}
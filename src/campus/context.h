@@ -0,0 +1,86 @@
+#ifndef CAMPUS_CONTEXT_H
+#define CAMPUS_CONTEXT_H
+
+#include "node.h"
+#include "../utils/distance.h"
+#include "../utils/visited.h"
+#include "../utils/topk.h"
+#include <vector>
+#include <utility>
+
+class Campus;
+
+// Long-lived per-thread state shared by the executors of one worker.
+// It owns the distance functor, the visited table and the scratch buffers used by insert and query,
+// so that steady-state operations reuse their capacity instead of allocating.
+// A context must not be used by two threads at the same time.
+class CampusContext {
+public:
+    explicit CampusContext(Campus *campus);
+    ~CampusContext();
+
+    CampusContext(const CampusContext&) = delete;
+    CampusContext &operator=(const CampusContext&) = delete;
+
+    Campus *getCampus() const { return campus_; }
+    Distance *getDistance() const { return distance_; }
+
+    // scratch for queries
+    std::vector<std::pair<float, Node*>> &getNodeHeap() { return node_heap_; }
+    std::vector<std::pair<float, Node*>> &getSearchCandidates() { return search_candidates_; }
+    TopKSelector &getSelector() { return selector_; }
+    // (id, distance) results of CampusQueryExecutor::query(std::vector<int>&)
+    std::vector<std::pair<int, float>> &getResults() { return results_; }
+    std::vector<std::pair<float, int>> &getRouterHeap() { return router_heap_; }
+    std::vector<Node*> &getNearestNodes() { return nearest_nodes_; }
+    VisitedTable &getVisitedTable() { return visited_table_; }
+    std::vector<std::pair<float, int>> &getProbeHeap() { return probe_heap_; }
+    std::vector<float> &getCentroidDistances() { return centroid_distances_; }
+    std::vector<float> &getProbeSamples() { return probe_samples_; }
+    // per-worker scratch of parallel scans, indexed by the ThreadPool worker
+    std::vector<std::vector<std::pair<float, Node*>>> &getWorkerNodeHeaps() { return worker_node_heaps_; }
+    std::vector<TopKSelector> &getWorkerSelectors() { return worker_selectors_; }
+    // scratch of Campus::searchBatch: (node, query) pairs, a selector per query, and the
+    // gathered posting of the current group with its ids, queries and distances
+    std::vector<std::pair<Node*, int>> &getBatchAssignments() { return batch_assignments_; }
+    std::vector<TopKSelector> &getBatchSelectors() { return batch_selectors_; }
+    std::vector<char> &getBatchBlock() { return batch_block_; }
+    std::vector<int> &getBatchIds() { return batch_ids_; }
+    std::vector<const void*> &getBatchGroup() { return batch_group_; }
+    std::vector<float> &getBatchDistances() { return batch_distances_; }
+
+    // scratch for insert transactions
+    std::vector<Version*> &getChangedVersions() { return changed_versions_; }
+    std::vector<Node*> &getNewNodes() { return new_nodes_; }
+    std::vector<Version*> &getNewVersions() { return new_versions_; }
+
+    // Clear all buffers without releasing their capacity.
+    void reset();
+
+private:
+    Campus *campus_;
+    Distance *distance_;
+    std::vector<std::pair<float, Node*>> node_heap_;
+    std::vector<std::pair<float, Node*>> search_candidates_;
+    TopKSelector selector_;
+    std::vector<std::pair<int, float>> results_;
+    std::vector<std::pair<float, int>> router_heap_;
+    std::vector<Node*> nearest_nodes_;
+    VisitedTable visited_table_;
+    std::vector<std::pair<float, int>> probe_heap_;
+    std::vector<float> centroid_distances_;
+    std::vector<float> probe_samples_;
+    std::vector<std::vector<std::pair<float, Node*>>> worker_node_heaps_;
+    std::vector<TopKSelector> worker_selectors_;
+    std::vector<std::pair<Node*, int>> batch_assignments_;
+    std::vector<TopKSelector> batch_selectors_;
+    std::vector<char> batch_block_;
+    std::vector<int> batch_ids_;
+    std::vector<const void*> batch_group_;
+    std::vector<float> batch_distances_;
+    std::vector<Version*> changed_versions_;
+    std::vector<Node*> new_nodes_;
+    std::vector<Version*> new_versions_;
+};
+
+#endif //CAMPUS_CONTEXT_H
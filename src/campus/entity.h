@@ -1,14 +1,22 @@
 #ifndef CAMPUS_ENTITY_H
 #define CAMPUS_ENTITY_H
 
+#include "../utils/prefetch.h"
 #include <cstring>
+#include <climits>
 
 struct Entity {
+    // timestamp of vectors that never expire
+    static const long NO_TIMESTAMP = LONG_MAX;
+
     int id;
     void *vector;
     int dimension;
+    bool is_replica; // extra copy of a vector whose primary lives in another posting
+    long timestamp; // caller-defined time; the entry expires once Campus::expireBefore passes it
 
-    Entity(int id, const void* vec, int dim, size_t element_size) : id(id), dimension(dim) {
+    Entity(int id, const void* vec, int dim, size_t element_size, bool is_replica = false, long timestamp = NO_TIMESTAMP)
+        : id(id), dimension(dim), is_replica(is_replica), timestamp(timestamp) {
         vector = new char[dim * element_size];
         std::memcpy(vector, vec, dim * element_size);
     }
@@ -22,4 +30,18 @@ struct Entity {
     }
 };
 
+// Same pipeline for the entities of a posting: the entity of item i + 2 * distance and
+// the vector of i + distance are prefetched.
+inline void prefetchEntities(Entity *const *posting, int size, int i, int distance, size_t vector_size) {
+    if (distance <= 0) {
+        return;
+    }
+    if (i + 2 * distance < size) {
+        prefetchRead(posting[i + 2 * distance]);
+    }
+    if (i + distance < size) {
+        prefetchRange(posting[i + distance]->getVector(), vector_size);
+    }
+}
+
 #endif //CAMPUS_ENTITY_H
\ No newline at end of file
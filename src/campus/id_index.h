@@ -0,0 +1,100 @@
+#ifndef CAMPUS_ID_INDEX_H
+#define CAMPUS_ID_INDEX_H
+
+#include "node.h"
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+
+// Where the primary of each vector lives: id -> (node, index in its posting).
+// Entries are written when a version is committed, so the index is only a hint once later
+// versions have moved entries around; readers check the posting and fall back to a scan of
+// the node. Sharded by id, each shard a hash map under its own mutex.
+class IdIndex {
+public:
+    struct Location {
+        Node *node;
+        int index;
+    };
+
+    // Record every primary of a committed version.
+    void updateAll(Version *version) {
+        Node *node = version->getNode();
+        Entity **posting = version->getPosting();
+        for (int i = 0; i < version->getVectorNum(); ++i) {
+            if (!posting[i]->is_replica) {
+                set(posting[i]->id, Location{node, i});
+            }
+        }
+    }
+
+    // Record the primaries a transaction added to a committed version (Version::getAddedIds()).
+    // Entries copied from the previous version stay in the same node, so their old location
+    // is still a valid hint.
+    void update(Version *version) {
+        std::vector<int> added_ids = version->getAddedIds();
+        if (added_ids.empty()) {
+            return;
+        }
+        std::sort(added_ids.begin(), added_ids.end());
+        Node *node = version->getNode();
+        Entity **posting = version->getPosting();
+        for (int i = 0; i < version->getVectorNum(); ++i) {
+            if (!posting[i]->is_replica && std::binary_search(added_ids.begin(), added_ids.end(), posting[i]->id)) {
+                set(posting[i]->id, Location{node, i});
+            }
+        }
+    }
+
+    // Forget id unless it has been recorded in another node since.
+    void erase(int id, Node *node) {
+        Shard &shard = getShard(id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.locations.find(id);
+        if (it != shard.locations.end() && it->second.node == node) {
+            shard.locations.erase(it);
+        }
+    }
+
+    bool find(int id, Location &location) {
+        Shard &shard = getShard(id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.locations.find(id);
+        if (it == shard.locations.end()) {
+            return false;
+        }
+        location = it->second;
+        return true;
+    }
+
+    size_t size() {
+        size_t size = 0;
+        for (Shard &shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            size += shard.locations.size();
+        }
+        return size;
+    }
+
+private:
+    static const int SHARD_NUM = 64;
+
+    // one cache line per shard, so that writers of different shards do not contend
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<int, Location> locations;
+    };
+
+    Shard shards_[SHARD_NUM];
+
+    void set(int id, const Location &location) {
+        Shard &shard = getShard(id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.locations[id] = location;
+    }
+
+    Shard &getShard(int id) { return shards_[static_cast<unsigned>(id) % SHARD_NUM]; }
+};
+
+#endif //CAMPUS_ID_INDEX_H
@@ -1,15 +1,29 @@
 #include "campus.h"
+#include "../utils/kmeans.h"
 #include <cassert>
 #include <iostream>
-#include <unordered_set>
+#include <algorithm>
+#include <cstring>
+#include <thread>
 
 
-void CampusInsertExecutor::insert(){
+bool CampusInsertExecutor::insert(){
+    return execute();
+}
+
+bool CampusInsertExecutor::execute(){
+    EpochGuard guard(campus_->getEpochs());
+    int replace_retries = 0;
 RETRY:
+    // deleted ids are not reused; an id may also be deleted by a concurrent delete at any time
+    if (campus_->isDeleted(vector_id_)) {
+        abort();
+        return false;
+    }
     // If the campus is empty, create a new node and set it as the entry point
     if (campus_->getNodeNum() == 0) { 
         Node *new_node = new Node(campus_->getPositingLimit(),
-            campus_->getDimension(), sizeof(float));
+            campus_->getDimension(), sizeof(float), campus_->newNodeSlot());
         if (!campus_->validationLock()) {
             goto RETRY;
         }
@@ -18,49 +32,69 @@ RETRY:
             delete new_node;
             goto RETRY;
         }
+        Version *latest_version = new_node->getLatestVersion();
+        latest_version->addVector(insert_vector_, vector_id_, false, timestamp_);
+        campus_->switchVersion(new_node, latest_version);
         campus_->setEntryPoint(new_node);
         campus_->incrementNodeNum();
         campus_->addNode(new_node);
-        Version *latest_version = new_node->getLatestVersion();
-        latest_version->addVector(insert_vector_, vector_id_);
-        latest_version->calculateCentroid();
         campus_->validationUnlock();
-        return;
+        return true;
     } else {
         // Find the nearest node to the insert_vector_
-        Node *nearest_node = campus_->findExactNearestNode(insert_vector_, distance_);
+        Node *nearest_node = campus_->routeInsert(insert_vector_, context_);
         if (nearest_node == nullptr) {
             goto RETRY;
         }
+        if (campus_->getInsertSearchType() != Campus::ExactSearch && campus_->useRoutingExactFallback()
+            && !nearest_node->getLatestVersion()->canAddVector()) {
+            // Do not split a node the graph may have misrouted to
+            Node *exact_node = campus_->findExactNearestNode(insert_vector_, distance_);
+            if (exact_node != nullptr) {
+                nearest_node = exact_node;
+            }
+        }
         Version *latest_version = nearest_node->getLatestVersion();
         changed_versions_.push_back(latest_version);
-        if (latest_version->canAddVector()) {
+        bool replaced_in_place = false;
+        if (replace_ && !removeOldVector(nearest_node, replaced_in_place)) {
+            abort();
+            if (++replace_retries >= MAX_REPLACE_RETRIES) {
+                return false;
+            }
+            std::this_thread::yield();
+            goto RETRY;
+        }
+        // an upsert may already have a working version of nearest_node, with a replica removed
+        Version *working_version = findWorkingVersion(nearest_node);
+        if (!isWorkingVersion(working_version)) {
+            working_version = latest_version;
+        }
+        if (replaced_in_place) {
+            // No need to move
+        } else if (working_version->canAddVector()) {
             // No need to split
-            Version *new_version = new Version(latest_version->getVersion() + 1,  nearest_node,
-                latest_version, campus_->getPositingLimit(), campus_->getDimension(), campus_->getElementSize());
-            new_version->copyFromPrevVersion();
-            new_version->addVector(insert_vector_, vector_id_);
-            new_versions_.push_back(new_version);
+            if (working_version == latest_version) {
+                working_version = new Version(latest_version->getVersion() + 1,  nearest_node,
+                    latest_version, campus_->getPositingLimit(), campus_->getDimension(), campus_->getElementSize());
+                working_version->copyFromPrevVersion();
+                new_versions_.push_back(working_version);
+            }
+            working_version->addVector(insert_vector_, vector_id_, false, timestamp_);
+            addReplicas(nearest_node, insert_vector_, vector_id_, timestamp_);
         } else {
             // Need to split
-            splitCalculation(latest_version, insert_vector_, vector_id_);
+            new_versions_.erase(std::remove(new_versions_.begin(), new_versions_.end(), working_version), new_versions_.end());
+            splitCalculation(working_version, insert_vector_, vector_id_, timestamp_);
         }
 
 
         while(!campus_->validationLock()) {}
         if (validation()){
             commit();
-            if (new_nodes_.empty()) {
-                campus_->setEntryPoint(nearest_node);
-                campus_->validationUnlock();
-                return;
-            } else {
-                // new_nodes_から1つランダムに選択し、entry_point_として設定
-                int random_index = rand() % new_nodes_.size();
-                campus_->setEntryPoint(new_nodes_[random_index]);
-                campus_->validationUnlock();
-                return;
-            }
+            campus_->afterCommit(new_nodes_, distance_);
+            campus_->validationUnlock();
+            return true;
         } else {
             campus_->validationUnlock();
             abort();
@@ -71,11 +105,11 @@ RETRY:
 }
 
 
-void CampusInsertExecutor::splitCalculation(Version *spliting_version, const void *insert_vector, int vector_id) {
+void CampusInsertExecutor::splitCalculation(Version *spliting_version, const void *insert_vector, int vector_id, long timestamp) {
     Node *new_node1 = new Node(campus_->getPositingLimit(),
-        campus_->getDimension(), campus_->getElementSize(), spliting_version->getNode());
+        campus_->getDimension(), campus_->getElementSize(), campus_->newNodeSlot(), spliting_version->getNode());
     Node *new_node2 = new Node(campus_->getPositingLimit(),
-        campus_->getDimension(), campus_->getElementSize(), spliting_version->getNode());
+        campus_->getDimension(), campus_->getElementSize(), campus_->newNodeSlot(), spliting_version->getNode());
 
     new_nodes_.push_back(new_node1);
     new_nodes_.push_back(new_node2);
@@ -84,39 +118,213 @@ void CampusInsertExecutor::splitCalculation(Version *spliting_version, const voi
     Entity **posting = spliting_version->getPosting();
 
     // randomly assign vectors to new nodes
+    // replicas are dropped; their primaries live in other postings
+    // deleted and expired vectors are dropped as well, which saves the compactor a pass over the new nodes
     for (int i = 0; i < spliting_version->getVectorNum(); ++i) {
+        if (posting[i]->is_replica || campus_->isDead(posting[i])) {
+            continue;
+        }
         const void *vector = posting[i]->getVector();
         int vector_id = posting[i]->id;
+        long timestamp = posting[i]->timestamp;
         if (i < spliting_version->getVectorNum() / 2) {
-            new_node1->getLatestVersion()->addVector(vector, vector_id);
+            new_node1->getLatestVersion()->addVector(vector, vector_id, false, timestamp);
         }else{
-            new_node2->getLatestVersion()->addVector(vector, vector_id);
+            new_node2->getLatestVersion()->addVector(vector, vector_id, false, timestamp);
         }
     }
-    new_node1->getLatestVersion()->addVector(insert_vector, vector_id);
+    new_node1->getLatestVersion()->addVector(insert_vector, vector_id, false, timestamp);
 
     assignCalculation(new_node1, new_node2);
+    if (campus_->getSplitBalance() > 0) {
+        balanceCalculation(new_node1, new_node2);
+    }
     connectNeighbors(spliting_version, new_node1, new_node2, campus_->getConnectionLimit());
     updateNeighbors(spliting_version, new_node1, new_node2, campus_->getConnectionLimit());
     reassignCalculation(spliting_version, new_node1, new_node2);
+    addBoundaryReplicas(new_node1, new_node2);
+}
+
+void CampusInsertExecutor::addReplicas(Node *primary_node, const void *vector, int vector_id, long timestamp) {
+    // SPANN-style replication: also store the vector in up to replica_num neighboring postings
+    // whose centroids are within (1 + epsilon) of the primary's distance
+    int replica_num = campus_->getReplicaNum();
+    if (replica_num <= 0) {
+        return;
+    }
+    float limit = (1 + campus_->getReplicaEpsilon())
+        * distance_->calculateDistance(vector, findWorkingVersion(primary_node)->getCentroid(), campus_->getDimension());
+    std::vector<std::pair<float, Node*>> candidates;
+    for (Node *neighbor_node : primary_node->getLatestVersion()->getOutNeighbors()) {
+        if (neighbor_node->isArchived()) {
+            continue;
+        }
+        float distance = distance_->calculateDistance(vector, neighbor_node->getLatestVersion()->getCentroid(), campus_->getDimension());
+        if (distance <= limit) {
+            candidates.push_back(std::make_pair(distance, neighbor_node));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    int added = 0;
+    for (const std::pair<float, Node*> &candidate : candidates) {
+        if (added >= replica_num) {
+            break;
+        }
+        Version *replica_version = findWorkingVersion(candidate.second);
+        if (!replica_version->canAddVector()) {
+            // replicas never cause a split
+            continue;
+        }
+        if (!isWorkingVersion(replica_version)) {
+            Version *changed_version = replica_version;
+            replica_version = new Version(changed_version->getVersion() + 1, candidate.second, changed_version,
+                campus_->getPositingLimit(), campus_->getDimension(), campus_->getElementSize());
+            replica_version->copyFromPrevVersion();
+            new_versions_.push_back(replica_version);
+            changed_versions_.push_back(changed_version);
+        }
+        replica_version->addVector(vector, vector_id, true, timestamp);
+        added++;
+    }
+}
+
+void CampusInsertExecutor::addBoundaryReplicas(Node *new_node1, Node *new_node2) {
+    // After a split, vectors close to the new boundary are also stored in the sibling.
+    // At most half of the free room of each half is used so that it does not split again right away.
+    if (campus_->getReplicaNum() <= 0) {
+        return;
+    }
+    Version *version1 = new_node1->getLatestVersion();
+    Version *version2 = new_node2->getLatestVersion();
+    if (std::find(new_versions_.begin(), new_versions_.end(), version1) == new_versions_.end()
+        || std::find(new_versions_.begin(), new_versions_.end(), version2) == new_versions_.end()) {
+        // one of the halves has been split again during reassignment
+        return;
+    }
+    float ratio = 1 + campus_->getReplicaEpsilon();
+    int primary_num1 = version1->getVectorNum();
+    int primary_num2 = version2->getVectorNum();
+    int room1 = (campus_->getPositingLimit() - primary_num1) / 2;
+    int room2 = (campus_->getPositingLimit() - primary_num2) / 2;
+    for (int i = 0; i < primary_num1 && room2 > 0; ++i) {
+        Entity *entity = version1->getPosting()[i];
+        if (distance_->calculateDistance(entity->getVector(), version2->getCentroid(), campus_->getDimension())
+            <= ratio * distance_->calculateDistance(entity->getVector(), version1->getCentroid(), campus_->getDimension())) {
+            version2->addVector(entity->getVector(), entity->id, true, entity->timestamp);
+            room2--;
+        }
+    }
+    for (int i = 0; i < primary_num2 && room1 > 0; ++i) {
+        Entity *entity = version2->getPosting()[i];
+        if (distance_->calculateDistance(entity->getVector(), version1->getCentroid(), campus_->getDimension())
+            <= ratio * distance_->calculateDistance(entity->getVector(), version2->getCentroid(), campus_->getDimension())) {
+            version1->addVector(entity->getVector(), entity->id, true, entity->timestamp);
+            room1--;
+        }
+    }
+}
+
+bool CampusInsertExecutor::removeOldVector(Node *nearest_node, bool &replaced_in_place) {
+    int index;
+    Node *old_node = campus_->locateVector(vector_id_, index);
+    if (old_node == nullptr) {
+        IdIndex::Location location;
+        if (campus_->getIdIndex() == nullptr || !campus_->getIdIndex()->find(vector_id_, location)) {
+            return true;
+        }
+        // An expired entry stays in the index until its node is rewritten, and a split that drops
+        // it leaves the id mapped to the archived node. Both count as absent: the entry is dropped
+        // together with the old version, or the stale mapping is erased. Otherwise the index still
+        // maps the id while a concurrent commit moves it, so retry instead of duplicating it.
+        if (location.node->isArchived()) {
+            campus_->getIdIndex()->erase(vector_id_, location.node);
+            return false;
+        }
+        Version *location_version = location.node->getLatestVersion();
+        for (int i = 0; i < location_version->getVectorNum(); ++i) {
+            Entity *entity = location_version->getPosting()[i];
+            if (entity->id == vector_id_ && !entity->is_replica && campus_->isDead(entity)) {
+                campus_->getIdIndex()->erase(vector_id_, location.node);
+                old_node = location.node;
+                index = i;
+                break;
+            }
+        }
+        if (old_node == nullptr) {
+            return false;
+        }
+    }
+    Version *old_version = old_node->getLatestVersion();
+    Entity **posting = old_version->getPosting();
+    if (index >= old_version->getVectorNum() || posting[index]->id != vector_id_ || posting[index]->is_replica) {
+        // moved by a concurrent transaction
+        return false;
+    }
+    Version *working_version = new Version(old_version->getVersion() + 1, old_node, old_version,
+        campus_->getPositingLimit(), campus_->getDimension(), campus_->getElementSize());
+    working_version->copyFromPrevVersion();
+    working_version->deleteEntity(index);
+    new_versions_.push_back(working_version);
+    changed_versions_.push_back(old_version);
+    removeReplicas(old_version, vector_id_);
+    if (old_node == nearest_node) {
+        // same posting: no move, and the size does not change
+        working_version->addVector(insert_vector_, vector_id_, false, timestamp_);
+        addReplicas(old_node, insert_vector_, vector_id_, timestamp_);
+        replaced_in_place = true;
+    }
+    return true;
+}
+
+void CampusInsertExecutor::removeReplicas(Version *primary_version, int vector_id) {
+    // replicas are placed in the neighbors of the primary's node
+    if (campus_->getReplicaNum() <= 0) {
+        return;
+    }
+    for (const std::vector<Node*> *neighbors : {&primary_version->getOutNeighbors(), &primary_version->getInNeighbors()}) {
+        for (Node *neighbor_node : *neighbors) {
+            if (neighbor_node->isArchived()) {
+                continue;
+            }
+            Version *neighbor_version = findWorkingVersion(neighbor_node);
+            for (int i = 0; i < neighbor_version->getVectorNum(); ++i) {
+                Entity *entity = neighbor_version->getPosting()[i];
+                if (entity->id != vector_id || !entity->is_replica) {
+                    continue;
+                }
+                if (!isWorkingVersion(neighbor_version)) {
+                    Version *changed_version = neighbor_version;
+                    neighbor_version = new Version(changed_version->getVersion() + 1, neighbor_node, changed_version,
+                        campus_->getPositingLimit(), campus_->getDimension(), campus_->getElementSize());
+                    neighbor_version->copyFromPrevVersion();
+                    new_versions_.push_back(neighbor_version);
+                    changed_versions_.push_back(changed_version);
+                }
+                neighbor_version->deleteEntity(i);
+                break;
+            }
+        }
+    }
 }
 
 void CampusInsertExecutor::assignCalculation(Node *new_node1, Node *new_node2) {
     // k-means clustering for the new nodes
-    while (true) {
-        new_node1->getLatestVersion()->calculateCentroid();
-        new_node2->getLatestVersion()->calculateCentroid();
+    // Centroids follow every move incrementally (online k-means), so no per-round recalculation is needed.
+    // The round limit only guards against floating-point ping-pong between near-equidistant vectors.
+    for (int round = 0; round < MAX_ASSIGN_ROUNDS; ++round) {
         bool changed = false;
         for (int i = 0; i < new_node1->getLatestVersion()->getVectorNum(); ++i) {
             const void *vector = new_node1->getLatestVersion()->getPosting()[i]->getVector();
             int vector_id = new_node1->getLatestVersion()->getPosting()[i]->id;
+            long timestamp = new_node1->getLatestVersion()->getPosting()[i]->timestamp;
             float distance1 = distance_->calculateDistance(vector,
                 new_node1->getLatestVersion()->getCentroid(), campus_->getDimension());
             float distance2 = distance_->calculateDistance(vector,
                 new_node2->getLatestVersion()->getCentroid(), campus_->getDimension());
             if (distance1 > distance2) {
                 new_node1->getLatestVersion()->deleteVector(vector_id);
-                new_node2->getLatestVersion()->addVector(vector, vector_id);
+                new_node2->getLatestVersion()->addVector(vector, vector_id, false, timestamp);
                 changed = true;
                 i--;
             }
@@ -124,13 +332,14 @@ void CampusInsertExecutor::assignCalculation(Node *new_node1, Node *new_node2) {
         for (int i = 0; i < new_node2->getLatestVersion()->getVectorNum(); ++i) {
             const void *vector = new_node2->getLatestVersion()->getPosting()[i]->getVector();
             int vector_id = new_node2->getLatestVersion()->getPosting()[i]->id;
+            long timestamp = new_node2->getLatestVersion()->getPosting()[i]->timestamp;
             float distance1 = distance_->calculateDistance(vector,
                 new_node1->getLatestVersion()->getCentroid(), campus_->getDimension());
             float distance2 = distance_->calculateDistance(vector,
                 new_node2->getLatestVersion()->getCentroid(), campus_->getDimension());
             if (distance1 < distance2) {
                 new_node2->getLatestVersion()->deleteVector(vector_id);
-                new_node1->getLatestVersion()->addVector(vector, vector_id);
+                new_node1->getLatestVersion()->addVector(vector, vector_id, false, timestamp);
                 changed = true;
                 i--;
             }
@@ -143,6 +352,39 @@ void CampusInsertExecutor::assignCalculation(Node *new_node1, Node *new_node2) {
 
 
 
+void CampusInsertExecutor::balanceCalculation(Node *new_node1, Node *new_node2) {
+    // size-constrained 2-means: reassign both halves against the converged centroids with a cap,
+    // which only moves the vectors nearest to the boundary out of the larger half
+    Version *versions[2] = {new_node1->getLatestVersion(), new_node2->getLatestVersion()};
+    int dimension = campus_->getDimension();
+    size_t vector_size = dimension * campus_->getElementSize();
+    std::vector<Entity*> entities;
+    std::vector<const void*> vectors;
+    for (Version *version : versions) {
+        for (int i = 0; i < version->getVectorNum(); ++i) {
+            entities.push_back(version->getPosting()[i]);
+            vectors.push_back(version->getPosting()[i]->getVector());
+        }
+    }
+    std::vector<char> centroids(2 * vector_size);
+    std::memcpy(centroids.data(), versions[0]->getCentroid(), vector_size);
+    std::memcpy(centroids.data() + vector_size, versions[1]->getCentroid(), vector_size);
+    std::vector<float> distances(vectors.size() * 2);
+    distance_->calculateDistances(vectors.data(), vectors.size(), centroids.data(), 2, dimension, distances.data());
+    std::vector<int> labels;
+    assignBalanced(distances.data(), vectors.size(), 2, campus_->getSplitBalance() * vectors.size() / 2, labels);
+
+    int first_num = versions[0]->getVectorNum();
+    for (size_t i = 0; i < entities.size(); ++i) {
+        int from = i < first_num ? 0 : 1;
+        if (labels[i] != from) {
+            Entity *entity = entities[i];
+            versions[from]->deleteVector(entity->id);
+            versions[labels[i]]->addVector(entity->getVector(), entity->id, false, entity->timestamp);
+        }
+    }
+}
+
 void CampusInsertExecutor::connectNeighbors(Version *spliting_version, Node *new_node1, Node *new_node2, int connection_limit) {
     std::vector<Node*> neighbors1 = spliting_version->getOutNeighbors();
     std::vector<Node*> neighbors2 = spliting_version->getOutNeighbors();
@@ -177,65 +419,20 @@ void CampusInsertExecutor::connectNeighbors(Version *spliting_version, Node *new
     new_node1->getLatestVersion()->addInNeighbor(new_node2);
     new_node2->getLatestVersion()->addInNeighbor(new_node1);
 
-    // if the number of neighbors exceeds the connection limit, remove the farthest neighbor
+    // if the number of neighbors exceeds the connection limit, keep a diverse subset
+    std::vector<Node*> dropped;
     if (neighbors1.size() > connection_limit) {
-        float max_distance = 0;
-        Version* farthest_version = nullptr;
-        for (Node* neighbor_node : neighbors1) {
-            Version *neighbor_version = nullptr;
-            for (Version *existing_version : new_versions_) {
-                if (existing_version->getNode() == neighbor_node) {
-                    neighbor_version = existing_version;
-                    break;
-                }
-            }
-            if (neighbor_node==new_node2){
-                neighbor_version = new_node2->getLatestVersion();
-            }
-            assert(neighbor_version != nullptr);
-
-            float distance = distance_->calculateDistance(new_node1->getLatestVersion()->getCentroid(),
-                neighbor_version->getCentroid(), campus_->getDimension());
-            if (distance > max_distance) {
-                max_distance = distance;
-                farthest_version = neighbor_version;
-            }
+        pruneNeighbors(new_node1->getLatestVersion()->getCentroid(), neighbors1, connection_limit, dropped);
+        for (Node* dropped_node : dropped) {
+            findWorkingVersion(dropped_node)->deleteInNeighbor(new_node1);
         }
-        // TODO: 書き変わっている時の処理
-        neighbors1.erase(std::remove_if(neighbors1.begin(), neighbors1.end(),
-            [farthest_version](Node* node) {
-                return node == farthest_version->getNode();
-            }), neighbors1.end());
-        farthest_version->deleteInNeighbor(new_node1);
     }
+    dropped.clear();
     if (neighbors2.size() > connection_limit) {
-        float max_distance = 0;
-        Version* farthest_version = nullptr;
-        for (Node* neighbor_node : neighbors2) {
-            Version *neighbor_version = nullptr;
-            for (Version *existing_version : new_versions_) {
-                if (existing_version->getNode() == neighbor_node) {
-                    neighbor_version = existing_version;
-                    break;
-                }
-            }
-            if (neighbor_node==new_node1){
-                neighbor_version = new_node1->getLatestVersion();
-            }
-            assert(neighbor_version != nullptr);
-
-            float distance = distance_->calculateDistance(new_node2->getLatestVersion()->getCentroid(),
-                neighbor_version->getCentroid(), campus_->getDimension());
-            if (distance > max_distance) {
-                max_distance = distance;
-                farthest_version = neighbor_version;
-            }
+        pruneNeighbors(new_node2->getLatestVersion()->getCentroid(), neighbors2, connection_limit, dropped);
+        for (Node* dropped_node : dropped) {
+            findWorkingVersion(dropped_node)->deleteInNeighbor(new_node2);
         }
-        neighbors2.erase(std::remove_if(neighbors2.begin(), neighbors2.end(),
-            [farthest_version](Node* node) {
-                return node == farthest_version->getNode();
-            }), neighbors2.end());
-        farthest_version->deleteInNeighbor(new_node2);
     }
 
     // neighbor1とneighbor2をそれぞれ、new_node1とnew_node2のout_neighbors_に設定
@@ -291,53 +488,59 @@ void CampusInsertExecutor::updateNeighbors(Version *spliting_version, Node *new_
         new_version->deleteOutNeighbor(spliting_version->getNode());
 
         if (new_version->getOutNeighbors().size() > connection_limit) {
-            float max_distance = 0;
-            Node* farthest_neighbor = nullptr;
-            for (Node* neighbor_neighbor : new_version->getOutNeighbors()) {
-                // TODO: getLatestVersion()を使うべきかどうか
-                float distance = distance_->calculateDistance(new_version->getCentroid(),
-                    neighbor_neighbor->getLatestVersion()->getCentroid(), campus_->getDimension());
-                if (distance > max_distance) {
-                    max_distance = distance;
-                    farthest_neighbor = neighbor_neighbor;
+            std::vector<Node*> out_neighbors = new_version->getOutNeighbors();
+            std::vector<Node*> dropped;
+            pruneNeighbors(new_version->getCentroid(), out_neighbors, connection_limit, dropped);
+            for (Node* dropped_node : dropped) {
+                new_version->deleteOutNeighbor(dropped_node);
+                // TODO: dropped_nodeをreadするタイミングについて検討
+                Version *dropped_version = nullptr;
+                bool already_updated = false;
+                for (Version *existing_version : new_versions_) {
+                    if (existing_version->getNode() == dropped_node) {
+                        dropped_version = existing_version;
+                        already_updated = true;
+                        break;
+                    }
                 }
-                assert(distance != 0);
-            }
-            new_version->deleteOutNeighbor(farthest_neighbor);
-            // TODO: farthest_neighborをreadするタイミングについて検討
-            Version *farthest_version = nullptr;
-            bool already_updated = false;
-            for (Version *existing_version : new_versions_) {
-                if (existing_version->getNode() == farthest_neighbor) {
-                    farthest_version = existing_version;
+                if (dropped_node==new_node1){
+                    dropped_version = new_node1->getLatestVersion();
                     already_updated = true;
-                    break;
                 }
+                if (dropped_node==new_node2){
+                    dropped_version = new_node2->getLatestVersion();
+                    already_updated = true;
+                }
+                if (!already_updated) {
+                    Version* changed_version = dropped_node->getLatestVersion();
+                    dropped_version = new Version(changed_version->getVersion() + 1,
+                        changed_version->getNode(), changed_version,
+                        campus_->getPositingLimit(), campus_->getDimension(), campus_->getElementSize());
+                    dropped_version->copyFromPrevVersion();
+                    new_versions_.push_back(dropped_version);
+                    changed_versions_.push_back(changed_version);
+                }
+                dropped_version->deleteInNeighbor(new_version->getNode());
             }
-            if (farthest_neighbor==new_node1){
-                farthest_version = new_node1->getLatestVersion();
-                already_updated = true;
-            }
-            if (farthest_neighbor==new_node2){
-                farthest_version = new_node2->getLatestVersion();
-                already_updated = true;
-            }
-            if (!already_updated) {
-                Version* changed_version = farthest_neighbor->getLatestVersion();
-                farthest_version = new Version(changed_version->getVersion() + 1,
-                    changed_version->getNode(), changed_version,
-                    campus_->getPositingLimit(), campus_->getDimension(), campus_->getElementSize());
-                farthest_version->copyFromPrevVersion();
-                new_versions_.push_back(farthest_version);
-                changed_versions_.push_back(changed_version);
-            }
-            farthest_version->deleteInNeighbor(new_version->getNode());
         }
 
     }
 
 }
 
+Version *CampusInsertExecutor::findWorkingVersion(Node *node) {
+    return Campus::findWorkingVersion(node, new_versions_);
+}
+
+bool CampusInsertExecutor::isWorkingVersion(Version *version) const {
+    // compared by identity: the latest version may have been replaced since it was read
+    return std::find(new_versions_.begin(), new_versions_.end(), version) != new_versions_.end();
+}
+
+void CampusInsertExecutor::pruneNeighbors(const void *base_centroid, std::vector<Node*> &neighbors, int connection_limit, std::vector<Node*> &dropped) {
+    campus_->pruneNeighbors(base_centroid, neighbors, connection_limit, new_versions_, distance_, dropped);
+}
+
 void CampusInsertExecutor::reassignCalculation(Version *spliting_version, Node *new_node1, Node *new_node2) {
     Entity **posting1 = new_node1->getLatestVersion()->getPosting();
     for (int i = 0; i < new_node1->getLatestVersion()->getVectorNum(); ++i) {
@@ -376,16 +579,17 @@ void CampusInsertExecutor::reassignCalculation(Version *spliting_version, Node *
                 continue;
             } else {
                 int vector_id = posting1[i]->id;
+                long timestamp = posting1[i]->timestamp;
                 new_node1->getLatestVersion()->deleteVector(vector_id);
                 assert(closest_version != new_node2->getLatestVersion());
                 if (closest_version->canAddVector()) {
-                    closest_version->addVector(vector, vector_id);
+                    closest_version->addVector(vector, vector_id, false, timestamp);
                 } else {
                     Version *split_version = closest_version;
                     // delete split_version from new_versions_
                     new_versions_.erase(std::remove(new_versions_.begin(), new_versions_.end(),
                         split_version), new_versions_.end());
-                    splitCalculation(split_version, vector, vector_id);
+                    splitCalculation(split_version, vector, vector_id, timestamp);
                 }
                 i--;
             }
@@ -429,15 +633,16 @@ void CampusInsertExecutor::reassignCalculation(Version *spliting_version, Node *
                 continue;
             } else {
                 int vector_id = posting2[i]->id;
+                long timestamp = posting2[i]->timestamp;
                 new_node2->getLatestVersion()->deleteVector(vector_id);
                 assert(closest_version != new_node1->getLatestVersion());
                 if (closest_version->canAddVector()) {
-                    closest_version->addVector(vector, vector_id);
+                    closest_version->addVector(vector, vector_id, false, timestamp);
                 } else {
                     Version *split_version = closest_version;
                     new_versions_.erase(std::remove(new_versions_.begin(), new_versions_.end(),
                         split_version), new_versions_.end());
-                    splitCalculation(split_version, vector, vector_id);
+                    splitCalculation(split_version, vector, vector_id, timestamp);
                 }
                 i--;
             }
@@ -445,14 +650,19 @@ void CampusInsertExecutor::reassignCalculation(Version *spliting_version, Node *
     }
 
     // new_node1とnew_node2のin_neighborsの集合を取得してstd::vectorに変換
-    std::unordered_set<Node*> in_neighbors_set;
+    VisitedTable &visited = context_->getVisitedTable();
+    visited.reset();
+    std::vector<Node*> in_neighbors;
     for (Node* neighbor_node : new_node1->getLatestVersion()->getInNeighbors()) {
-        in_neighbors_set.insert(neighbor_node);
+        if (visited.visit(neighbor_node->getSlot())) {
+            in_neighbors.push_back(neighbor_node);
+        }
     }
     for (Node* neighbor_node : new_node2->getLatestVersion()->getInNeighbors()) {
-        in_neighbors_set.insert(neighbor_node);
+        if (visited.visit(neighbor_node->getSlot())) {
+            in_neighbors.push_back(neighbor_node);
+        }
     }
-    std::vector<Node*> in_neighbors(in_neighbors_set.begin(), in_neighbors_set.end());
 
     for (Node* neighbor_node : in_neighbors){
         if (neighbor_node == new_node1 || neighbor_node == new_node2) {
@@ -469,6 +679,9 @@ void CampusInsertExecutor::reassignCalculation(Version *spliting_version, Node *
 
         Entity **posting = neighbor->getPosting();
         for (int i = 0; i < neighbor->getVectorNum(); ++i) {
+            if (posting[i]->is_replica) {
+                continue;
+            }
             const void *vector = posting[i]->getVector();
             const void *old_centroid = spliting_version->getCentroid();
             const void *new_centroid1 = new_node1->getLatestVersion()->getCentroid();
@@ -484,28 +697,29 @@ void CampusInsertExecutor::reassignCalculation(Version *spliting_version, Node *
                     continue;
                 } else {
                     int vector_id = posting[i]->id;
+                    long timestamp = posting[i]->timestamp;
                     neighbor->deleteVector(vector_id);
                     if (new_distance1 < new_distance2) {
                         if (new_node1->getLatestVersion()->canAddVector()) {
-                            new_node1->getLatestVersion()->addVector(vector, vector_id);
+                            new_node1->getLatestVersion()->addVector(vector, vector_id, false, timestamp);
                         } else {
                             Version *split_version = new_node1->getLatestVersion();
                             // new_nodesから削除ということは、前のノードをarchiveできない？
                             // split→splitのprevious nodeを何に設定するか
                             // new_nodes_.erase(std::remove(new_nodes_.begin(), new_nodes_.end(), new_node1), new_nodes_.end());
                             new_versions_.erase(std::remove(new_versions_.begin(), new_versions_.end(), new_node1->getLatestVersion()), new_versions_.end());
-                            splitCalculation(split_version, vector, vector_id);
+                            splitCalculation(split_version, vector, vector_id, timestamp);
                             // TODO: returnして良いか検討
                             return;
                         }
                     } else {
                         if (new_node2->getLatestVersion()->canAddVector()) {
-                            new_node2->getLatestVersion()->addVector(vector, vector_id);
+                            new_node2->getLatestVersion()->addVector(vector, vector_id, false, timestamp);
                         } else {
                             Version *split_version = new_node2->getLatestVersion();
                             // new_nodes_.erase(std::remove(new_nodes_.begin(), new_nodes_.end(), new_node1), new_nodes_.end());
                             new_versions_.erase(std::remove(new_versions_.begin(), new_versions_.end(), new_node2->getLatestVersion()), new_versions_.end());
-                            splitCalculation(split_version, vector, vector_id);
+                            splitCalculation(split_version, vector, vector_id, timestamp);
                             // TODO: returnして良いか検討
                             return;
                         }
@@ -543,7 +757,7 @@ void CampusInsertExecutor::commit(){
 
     for (Node *node : new_nodes_) {
         if (node->getPrevNode() != nullptr) {
-            node->getPrevNode()->setArchived();
+            campus_->archiveNode(node->getPrevNode());
         }
         assert(node != nullptr);
         campus_->addNode(node);
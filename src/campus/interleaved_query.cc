@@ -0,0 +1,200 @@
+#include "campus.h"
+#include "../utils/prefetch.h"
+#include <algorithm>
+
+
+void CampusInterleavedQueryExecutor::query(std::vector<std::vector<std::pair<int, float>>> &results) {
+    EpochGuard guard(campus_->getEpochs());
+    context_->reset();
+    results.resize(query_vectors_.size());
+    if (search_type_ == Campus::ExactSearch) {
+        nodes_snapshot_ = campus_->getNodesSnapshot();
+    }
+    int width = std::max(interleave_width_, 1);
+    std::vector<QueryState> states(width);
+    for (size_t begin = 0; begin < query_vectors_.size(); begin += width) {
+        size_t group_end = std::min(query_vectors_.size(), begin + width);
+        int active = group_end - begin;
+        for (size_t i = begin; i < group_end; ++i) {
+            start(states[i - begin], query_vectors_[i]);
+        }
+        // round robin: one step of every unfinished query per pass
+        while (active > 0) {
+            for (int i = 0; i < group_end - begin; ++i) {
+                if (states[i].stage == QueryState::Done) {
+                    continue;
+                }
+                step(states[i]);
+                if (states[i].stage == QueryState::Done) {
+                    active--;
+                }
+            }
+        }
+        for (size_t i = begin; i < group_end; ++i) {
+            states[i - begin].selector.finish(results[i]);
+        }
+    }
+    nodes_snapshot_.reset();
+}
+
+void CampusInterleavedQueryExecutor::start(QueryState &state, const void *query_vector) {
+    state.query_vector = query_vector;
+    state.node_heap.clear();
+    state.nodes.clear();
+    state.selector.reset(top_k_);
+    state.cursor = 0;
+    if (search_type_ == Campus::ExactSearch) {
+        state.selecting = true;
+        state.stage = nodes_snapshot_->empty() ? QueryState::Done : QueryState::PrefetchNodes;
+        return;
+    }
+    // graph and index searches select their nodes up front; only the posting scan is interleaved
+    if (search_type_ == Campus::GraphSearch) {
+        campus_->findNearestNodes(query_vector, context_, node_num_, pq_size_, state.nodes);
+    } else {
+        campus_->findIndexedNearestNodes(query_vector, context_, node_num_, state.nodes);
+    }
+    startScan(state);
+}
+
+void CampusInterleavedQueryExecutor::startScan(QueryState &state) {
+    state.selecting = false;
+    state.cursor = 0;
+    state.stage = state.nodes.empty() ? QueryState::Done : QueryState::PrefetchNodes;
+}
+
+void CampusInterleavedQueryExecutor::step(QueryState &state) {
+    const int dimension = campus_->getDimension();
+    const size_t vector_size = dimension * campus_->getElementSize();
+    Distance *distance = context_->getDistance();
+
+    if (state.selecting) {
+        // exact centroid scan, GROUP_SIZE nodes at a time
+        const std::vector<Node*> &all_nodes = *nodes_snapshot_;
+        switch (state.stage) {
+            case QueryState::PrefetchNodes:
+                state.group_size = std::min<size_t>(GROUP_SIZE, all_nodes.size() - state.cursor);
+                for (int i = 0; i < state.group_size; ++i) {
+                    state.group_nodes[i] = all_nodes[state.cursor + i];
+                    prefetchRead(state.group_nodes[i]);
+                }
+                state.stage = QueryState::PrefetchVersions;
+                return;
+            case QueryState::PrefetchVersions:
+                for (int i = 0; i < state.group_size; ++i) {
+                    state.group_versions[i] = state.group_nodes[i]->isArchived() ? nullptr : state.group_nodes[i]->getLatestVersion();
+                    if (state.group_versions[i] != nullptr) {
+                        prefetchRead(state.group_versions[i]);
+                    }
+                }
+                state.stage = QueryState::PrefetchVectors;
+                return;
+            case QueryState::PrefetchVectors:
+                for (int i = 0; i < state.group_size; ++i) {
+                    if (state.group_versions[i] != nullptr) {
+                        prefetchRange(state.group_versions[i]->getCentroid(), vector_size);
+                    }
+                }
+                state.stage = QueryState::Score;
+                return;
+            case QueryState::Score: {
+                std::vector<std::pair<float, Node*>> &heap = state.node_heap;
+                for (int i = 0; i < state.group_size; ++i) {
+                    if (state.group_versions[i] == nullptr) {
+                        continue;
+                    }
+                    float current_distance = distance->calculateDistance(state.group_versions[i]->getCentroid(), state.query_vector, dimension);
+                    if (heap.size() < node_num_) {
+                        heap.push_back(std::make_pair(current_distance, state.group_nodes[i]));
+                        std::push_heap(heap.begin(), heap.end());
+                    } else if (current_distance < heap.front().first) {
+                        std::pop_heap(heap.begin(), heap.end());
+                        heap.back() = std::make_pair(current_distance, state.group_nodes[i]);
+                        std::push_heap(heap.begin(), heap.end());
+                    }
+                }
+                state.cursor += state.group_size;
+                if (state.cursor < all_nodes.size()) {
+                    state.stage = QueryState::PrefetchNodes;
+                    return;
+                }
+                // nearest first
+                std::sort_heap(heap.begin(), heap.end());
+                for (const std::pair<float, Node*> &entry : heap) {
+                    state.nodes.push_back(entry.second);
+                }
+                startScan(state);
+                return;
+            }
+            default:
+                return;
+        }
+    }
+
+    // posting scan, one node at a time and GROUP_SIZE entities per step
+    switch (state.stage) {
+        case QueryState::PrefetchNodes:
+            prefetchRead(state.nodes[state.cursor]);
+            state.stage = QueryState::PrefetchVersions;
+            return;
+        case QueryState::PrefetchVersions:
+            state.version = state.nodes[state.cursor]->getLatestVersion();
+            prefetchRead(state.version);
+            state.stage = QueryState::PrefetchPosting;
+            return;
+        case QueryState::PrefetchPosting:
+            if (campus_->hasDeadEntries() && campus_->isExpired(state.version)) {
+                // nothing to score; go straight to the next posting
+                state.entity = state.version->getVectorNum();
+                state.stage = QueryState::PrefetchEntities;
+                return;
+            }
+            prefetchRange(state.version->getPosting(), state.version->getVectorNum() * sizeof(Entity*));
+            state.entity = 0;
+            state.stage = QueryState::PrefetchEntities;
+            return;
+        case QueryState::PrefetchEntities:
+            state.group_size = std::min(GROUP_SIZE, state.version->getVectorNum() - state.entity);
+            for (int i = 0; i < state.group_size; ++i) {
+                prefetchRead(state.version->getPosting()[state.entity + i]);
+            }
+            state.stage = QueryState::PrefetchVectors;
+            return;
+        case QueryState::PrefetchVectors:
+            for (int i = 0; i < state.group_size; ++i) {
+                prefetchRange(state.version->getPosting()[state.entity + i]->getVector(), vector_size);
+            }
+            state.stage = QueryState::Score;
+            return;
+        case QueryState::Score: {
+            TopKSelector &selector = state.selector;
+            bool dedup = campus_->getReplicaNum() > 0;
+            bool filter_deleted = campus_->hasDeadEntries();
+            for (int i = 0; i < state.group_size; ++i) {
+                Entity *entity = state.version->getPosting()[state.entity + i];
+                float entity_distance = distance->calculateDistance(entity->getVector(), state.query_vector, dimension);
+                if (!(entity_distance < selector.getThreshold())) {
+                    continue;
+                }
+                if (filter_deleted && campus_->isDead(entity)) {
+                    continue;
+                }
+                if (dedup && selector.contains(entity->id)) {
+                    continue;
+                }
+                selector.push(entity_distance, entity->id);
+            }
+            state.entity += state.group_size;
+            if (state.entity < state.version->getVectorNum()) {
+                state.stage = QueryState::PrefetchEntities;
+            } else if (++state.cursor < state.nodes.size()) {
+                state.stage = QueryState::PrefetchNodes;
+            } else {
+                state.stage = QueryState::Done;
+            }
+            return;
+        }
+        default:
+            return;
+    }
+}
@@ -0,0 +1,195 @@
+#include "campus.h"
+#include <cassert>
+#include <limits>
+#include <algorithm>
+
+
+bool CampusMergeExecutor::merge() {
+    EpochGuard guard(campus_->getEpochs());
+    if (node_->isArchived()) {
+        return false;
+    }
+    Version *merging_version = node_->getLatestVersion();
+    // a posting that has expired as a whole is retired at any size, and nothing is moved
+    bool expired = campus_->isExpired(merging_version);
+    if (merging_version->getPrimaryNum() >= campus_->getMergeThreshold() && !expired) {
+        return false;
+    }
+    // replicas, deleted and expired vectors are not carried over
+    Entity **posting = merging_version->getPosting();
+    int moving_num = 0;
+    for (int i = 0; i < merging_version->getVectorNum() && !expired; ++i) {
+        if (!posting[i]->is_replica && !campus_->isDead(posting[i])) {
+            moving_num++;
+        }
+    }
+    Node *target_node = findTarget(merging_version, moving_num);
+    if (target_node == nullptr) {
+        return false;
+    }
+
+    changed_versions_.push_back(merging_version);
+    Version *target_version = getWorkingVersion(target_node);
+    for (int i = 0; i < merging_version->getVectorNum() && !expired; ++i) {
+        if (posting[i]->is_replica || campus_->isDead(posting[i])) {
+            continue;
+        }
+        // a replica of the vector in the target is superseded by its primary
+        Entity **target_posting = target_version->getPosting();
+        for (int j = 0; j < target_version->getVectorNum(); ++j) {
+            if (target_posting[j]->id == posting[i]->id && target_posting[j]->is_replica) {
+                target_version->deleteEntity(j);
+                break;
+            }
+        }
+        target_version->addVector(posting[i]->getVector(), posting[i]->id, false, posting[i]->timestamp);
+    }
+    rewireNeighbors(merging_version, target_node);
+
+    while (!campus_->validationLock()) {}
+    if (validation()) {
+        commit(target_node);
+        campus_->afterCommit(new_nodes_, distance_);
+        campus_->validationUnlock();
+        return true;
+    }
+    campus_->validationUnlock();
+    abort();
+    return false;
+}
+
+Node *CampusMergeExecutor::findTarget(Version *merging_version, int moving_num) {
+    // the nearest live neighbor, in either direction, with room for the whole posting
+    Node *target_node = nullptr;
+    float min_distance = std::numeric_limits<float>::max();
+    for (const std::vector<Node*> *neighbors : {&merging_version->getOutNeighbors(), &merging_version->getInNeighbors()}) {
+        for (Node *neighbor_node : *neighbors) {
+            if (neighbor_node == node_ || neighbor_node->isArchived()) {
+                continue;
+            }
+            Version *neighbor_version = neighbor_node->getLatestVersion();
+            if (neighbor_version->getVectorNum() + moving_num > campus_->getPositingLimit()) {
+                continue;
+            }
+            float distance = distance_->calculateDistance(merging_version->getCentroid(), neighbor_version->getCentroid(), campus_->getDimension());
+            if (distance < min_distance) {
+                min_distance = distance;
+                target_node = neighbor_node;
+            }
+        }
+    }
+    return target_node;
+}
+
+Version *CampusMergeExecutor::getWorkingVersion(Node *node) {
+    Version *working_version = Campus::findWorkingVersion(node, new_versions_);
+    if (std::find(new_versions_.begin(), new_versions_.end(), working_version) != new_versions_.end()) {
+        return working_version;
+    }
+    Version *changed_version = working_version;
+    working_version = new Version(changed_version->getVersion() + 1, node, changed_version,
+        campus_->getPositingLimit(), campus_->getDimension(), campus_->getElementSize());
+    working_version->copyFromPrevVersion();
+    new_versions_.push_back(working_version);
+    changed_versions_.push_back(changed_version);
+    return working_version;
+}
+
+void CampusMergeExecutor::rewireNeighbors(Version *merging_version, Node *target_node) {
+    // edges of the merged node are redirected to the target, skipping those it already has
+    Version *target_version = getWorkingVersion(target_node);
+    target_version->deleteOutNeighbor(node_);
+    target_version->deleteInNeighbor(node_);
+    for (Node *neighbor_node : merging_version->getOutNeighbors()) {
+        if (neighbor_node == target_node || neighbor_node->isArchived()) {
+            continue;
+        }
+        Version *neighbor_version = getWorkingVersion(neighbor_node);
+        neighbor_version->deleteInNeighbor(node_);
+        const std::vector<Node*> &target_out = target_version->getOutNeighbors();
+        if (std::find(target_out.begin(), target_out.end(), neighbor_node) == target_out.end()) {
+            target_version->addOutNeighbor(neighbor_node);
+            neighbor_version->addInNeighbor(target_node);
+        }
+    }
+    std::vector<Node*> updated_in_neighbors;
+    for (Node *neighbor_node : merging_version->getInNeighbors()) {
+        if (neighbor_node == target_node || neighbor_node->isArchived()) {
+            continue;
+        }
+        Version *neighbor_version = getWorkingVersion(neighbor_node);
+        neighbor_version->deleteOutNeighbor(node_);
+        const std::vector<Node*> &neighbor_out = neighbor_version->getOutNeighbors();
+        if (std::find(neighbor_out.begin(), neighbor_out.end(), target_node) == neighbor_out.end()) {
+            neighbor_version->addOutNeighbor(target_node);
+            target_version->addInNeighbor(neighbor_node);
+            updated_in_neighbors.push_back(neighbor_node);
+        }
+    }
+
+    // out-degrees may now exceed the connection limit
+    pruneOutNeighbors(target_version);
+    for (Node *neighbor_node : updated_in_neighbors) {
+        pruneOutNeighbors(getWorkingVersion(neighbor_node));
+    }
+}
+
+void CampusMergeExecutor::pruneOutNeighbors(Version *version) {
+    if (version->getOutNeighbors().size() <= campus_->getConnectionLimit()) {
+        return;
+    }
+    std::vector<Node*> out_neighbors = version->getOutNeighbors();
+    std::vector<Node*> dropped;
+    campus_->pruneNeighbors(version->getCentroid(), out_neighbors, campus_->getConnectionLimit(), new_versions_, distance_, dropped);
+    for (Node *dropped_node : dropped) {
+        version->deleteOutNeighbor(dropped_node);
+        if (!dropped_node->isArchived()) {
+            getWorkingVersion(dropped_node)->deleteInNeighbor(version->getNode());
+        }
+    }
+}
+
+bool CampusMergeExecutor::validation() {
+    for (Version *version : changed_versions_) {
+        assert(version != nullptr);
+        if (version->getNode()->isArchived()) {
+            return false;
+        }
+        if (version->getNode()->getLatestVersion() != version) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CampusMergeExecutor::commit(Node *target_node) {
+    campus_->incrementUpdateCounter();
+    int updater_id = campus_->getUpdateCounter();
+    for (Version *version : new_versions_) {
+        campus_->switchVersion(version->getNode(), version);
+        version->setUpdaterId(updater_id);
+    }
+    campus_->archiveNode(node_);
+    // the moved primaries have been recorded under the target; forget the deleted ones
+    if (campus_->getIdIndex() != nullptr) {
+        Version *merged_version = changed_versions_.front();
+        for (int i = 0; i < merged_version->getVectorNum(); ++i) {
+            Entity *entity = merged_version->getPosting()[i];
+            if (!entity->is_replica) {
+                campus_->getIdIndex()->erase(entity->id, node_);
+            }
+        }
+    }
+    if (campus_->getEntryPoint() == node_) {
+        campus_->setEntryPoint(target_node);
+    }
+}
+
+void CampusMergeExecutor::abort() {
+    for (Version *version : new_versions_) {
+        delete version;
+    }
+    changed_versions_.clear();
+    new_nodes_.clear();
+    new_versions_.clear();
+}
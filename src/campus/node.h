@@ -2,16 +2,19 @@
 #define CAMPUS_NODE_H
 
 #include "version.h"
+#include "../utils/prefetch.h"
 #include <vector>
 #include <cassert>
 
 class Node {
 public:
-    Node(int max_posting_size, int dimension, size_t element_size, Node *prev_node = nullptr)
-        : archived_(false), version_count_(0), prev_node_(prev_node),
+    // slot is a dense id handed out by Campus::newNodeSlot(), used to index per-thread visited tables
+    Node(int max_posting_size, int dimension, size_t element_size, int slot, Node *prev_node = nullptr)
+        : archived_(false), version_count_(0), slot_(slot), prev_node_(prev_node),
             latest_version_(new Version(0, this, nullptr, max_posting_size, dimension, element_size)) {};
 
     Version *getLatestVersion() const { return latest_version_; }
+    int getSlot() const { return slot_; }
     Node *getPrevNode() const { return prev_node_; }
     bool isArchived() const { return archived_; }
     void addNeighbor(int neighbor_id);
@@ -25,8 +28,28 @@ public:
 private:
     bool archived_;
     int version_count_;
+    const int slot_;
     Version *latest_version_;
     Node *prev_node_;
 };
 
+// Software pipeline for scans over node lists, called once per item i. The node object of
+// item i + 3 * distance, the version of i + 2 * distance and the centroid of i + distance are
+// prefetched, so every stage only dereferences lines requested distance items earlier.
+// distance 0 disables prefetching.
+inline void prefetchNodes(Node *const *nodes, size_t size, size_t i, int distance, size_t centroid_size) {
+    if (distance <= 0) {
+        return;
+    }
+    if (i + 3 * distance < size) {
+        prefetchRead(nodes[i + 3 * distance]);
+    }
+    if (i + 2 * distance < size) {
+        prefetchRead(nodes[i + 2 * distance]->getLatestVersion());
+    }
+    if (i + distance < size) {
+        prefetchRange(nodes[i + distance]->getLatestVersion()->getCentroid(), centroid_size);
+    }
+}
+
 #endif //CAMPUS_NODE_H
\ No newline at end of file
@@ -0,0 +1,40 @@
+#include "probe_model.h"
+#include <limits>
+#include <algorithm>
+
+
+AdaptiveProbeModel::AdaptiveProbeModel(float recall_target, int calibration_interval, int window_size)
+    : recall_target_(recall_target), calibration_interval_(calibration_interval), window_size_(window_size),
+        ratio_(std::numeric_limits<float>::infinity()), query_counter_(0), next_sample_(0), samples_since_update_(0) {}
+
+bool AdaptiveProbeModel::shouldCalibrate() {
+    long query_count = query_counter_.fetch_add(1, std::memory_order_relaxed);
+    return getRatio() == std::numeric_limits<float>::infinity()
+        || (calibration_interval_ > 0 && query_count % calibration_interval_ == 0);
+}
+
+void AdaptiveProbeModel::addSamples(const std::vector<float> &ratios) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (float ratio : ratios) {
+        if (window_.size() < window_size_) {
+            window_.push_back(ratio);
+        } else {
+            window_[next_sample_] = ratio;
+            next_sample_ = (next_sample_ + 1) % window_size_;
+        }
+    }
+    samples_since_update_ += ratios.size();
+    // the first estimate needs a reasonably filled window, later ones follow the drift
+    int update_threshold = getRatio() == std::numeric_limits<float>::infinity() ? window_size_ / 16 : window_size_ / 8;
+    if (samples_since_update_ >= update_threshold) {
+        updateRatio();
+        samples_since_update_ = 0;
+    }
+}
+
+void AdaptiveProbeModel::updateRatio() {
+    std::vector<float> sorted(window_);
+    size_t index = std::min(sorted.size() - 1, static_cast<size_t>(recall_target_ * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    ratio_.store(sorted[index], std::memory_order_relaxed);
+}
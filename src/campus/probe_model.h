@@ -0,0 +1,39 @@
+#ifndef CAMPUS_PROBE_MODEL_H
+#define CAMPUS_PROBE_MODEL_H
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+// Learned early termination for the posting scan of topKSearch.
+// Postings are scanned nearest centroid first, and the scan stops at the first posting whose
+// centroid distance exceeds getRatio() times the current kth result distance.
+// Calibration queries scan every candidate posting and record, for each final top-k result,
+// its posting's centroid distance divided by the final kth distance. The ratio is the
+// recall_target quantile of a window of recent samples, so about that share of the true
+// results lies inside the bound.
+class AdaptiveProbeModel {
+public:
+    AdaptiveProbeModel(float recall_target, int calibration_interval, int window_size = 4096);
+
+    // Infinite (no early stop) until enough samples have been observed.
+    float getRatio() const { return ratio_.load(std::memory_order_relaxed); }
+    // True for every calibration_interval-th query, and for all queries while uncalibrated.
+    bool shouldCalibrate();
+    void addSamples(const std::vector<float> &ratios);
+
+private:
+    const float recall_target_;
+    const int calibration_interval_;
+    const int window_size_;
+    std::atomic<float> ratio_;
+    std::atomic<long> query_counter_;
+    std::mutex mutex_;
+    std::vector<float> window_; // ring buffer of ratios
+    size_t next_sample_;
+    int samples_since_update_;
+
+    void updateRatio();
+};
+
+#endif //CAMPUS_PROBE_MODEL_H
@@ -0,0 +1,178 @@
+#include "rebalancer.h"
+#include "campus.h"
+#include <limits>
+#include <algorithm>
+
+
+CampusRebalancer::CampusRebalancer(Campus *campus, int sample_size, int max_moves)
+    : campus_(campus), sample_size_(sample_size), max_moves_(max_moves), context_(new CampusContext(campus)),
+        sampled_nodes_(0), moved_vectors_(0), skipped_nodes_(0), rng_(std::random_device()()), worker_(nullptr) {}
+
+CampusRebalancer::~CampusRebalancer() {
+    delete worker_;
+    delete context_;
+}
+
+void CampusRebalancer::start(std::chrono::milliseconds interval) {
+    if (worker_ == nullptr) {
+        worker_ = new PeriodicWorker(interval, [this] { rebalance(); });
+    }
+}
+
+int CampusRebalancer::rebalance() {
+    std::lock_guard<std::mutex> lock(pass_mutex_);
+    EpochGuard guard(campus_->getEpochs());
+    std::shared_ptr<std::vector<Node*>> nodes_snapshot = campus_->getNodesSnapshot();
+    if (nodes_snapshot->size() < 2) {
+        return 0;
+    }
+    std::uniform_int_distribution<size_t> pick(0, nodes_snapshot->size() - 1);
+    int moved = 0;
+    for (int sample = 0; sample < sample_size_ && moved < max_moves_; ++sample) {
+        Node *node = (*nodes_snapshot)[pick(rng_)];
+        if (node->isArchived()) {
+            continue;
+        }
+        sampled_nodes_++;
+        moved += rebalanceNode(node, max_moves_ - moved);
+    }
+    return moved;
+}
+
+int CampusRebalancer::rebalanceNode(Node *node, int move_limit) {
+    Distance *distance = context_->getDistance();
+    int dimension = campus_->getDimension();
+    Version *latest_version = node->getLatestVersion();
+    // candidates: the neighbors of the node in both directions, and their out-neighbors
+    std::vector<Node*> &candidates = context_->getNearestNodes();
+    candidates.clear();
+    VisitedTable &visited = context_->getVisitedTable();
+    visited.reset();
+    visited.visit(node->getSlot());
+    for (const std::vector<Node*> *neighbors : {&latest_version->getOutNeighbors(), &latest_version->getInNeighbors()}) {
+        for (Node *neighbor_node : *neighbors) {
+            if (visited.visit(neighbor_node->getSlot())) {
+                candidates.push_back(neighbor_node);
+            }
+        }
+    }
+    size_t direct_num = candidates.size();
+    for (size_t j = 0; j < direct_num; ++j) {
+        for (Node *neighbor_node : candidates[j]->getLatestVersion()->getOutNeighbors()) {
+            if (visited.visit(neighbor_node->getSlot())) {
+                candidates.push_back(neighbor_node);
+            }
+        }
+    }
+    std::vector<Version*> candidate_versions;
+    for (Node *candidate : candidates) {
+        candidate_versions.push_back(candidate->isArchived() ? nullptr : candidate->getLatestVersion());
+    }
+
+    // find the misassigned primaries first, without building any version
+    moves_.clear();
+    Entity **posting = latest_version->getPosting();
+    for (int i = 0; i < latest_version->getVectorNum() && moves_.size() < move_limit; ++i) {
+        if (posting[i]->is_replica || campus_->isDead(posting[i])) {
+            continue;
+        }
+        float min_distance = distance->calculateDistance(posting[i]->getVector(), latest_version->getCentroid(), dimension);
+        Node *target_node = nullptr;
+        for (size_t j = 0; j < candidates.size(); ++j) {
+            if (candidate_versions[j] == nullptr) {
+                continue;
+            }
+            float candidate_distance = distance->calculateDistance(posting[i]->getVector(), candidate_versions[j]->getCentroid(), dimension);
+            if (candidate_distance < min_distance) {
+                min_distance = candidate_distance;
+                target_node = candidates[j];
+            }
+        }
+        if (target_node != nullptr) {
+            moves_.push_back(std::make_pair(i, target_node));
+        }
+    }
+    if (moves_.empty()) {
+        return 0;
+    }
+
+    context_->reset();
+    std::vector<Version*> &changed_versions = context_->getChangedVersions();
+    changed_versions.push_back(latest_version);
+    // copied from the version the moves were chosen on, so their posting indices hold
+    Version *source_version = new Version(latest_version->getVersion() + 1, node, latest_version,
+        campus_->getPositingLimit(), campus_->getDimension(), campus_->getElementSize());
+    source_version->copyFromPrevVersion();
+    context_->getNewVersions().push_back(source_version);
+    int moved = 0;
+    // from the back, so that the indices of the remaining moves stay valid in the source copy
+    for (auto move = moves_.rbegin(); move != moves_.rend(); ++move) {
+        Entity *entity = posting[move->first];
+        Version *target_version = getWorkingVersion(move->second);
+        if (!target_version->canAddVector()) {
+            // a move never splits
+            continue;
+        }
+        // a replica of the vector in the target is superseded by its primary
+        Entity **target_posting = target_version->getPosting();
+        for (int j = 0; j < target_version->getVectorNum(); ++j) {
+            if (target_posting[j]->id == entity->id && target_posting[j]->is_replica) {
+                target_version->deleteEntity(j);
+                break;
+            }
+        }
+        target_version->addVector(entity->getVector(), entity->id, false, entity->timestamp);
+        source_version->deleteEntity(move->first);
+        moved++;
+    }
+    if (moved == 0) {
+        abort();
+        return 0;
+    }
+
+    // only one try: foreground transactions go first, and the node is sampled again later
+    if (!campus_->validationLock()) {
+        abort();
+        skipped_nodes_++;
+        return 0;
+    }
+    for (Version *version : changed_versions) {
+        if (version->getNode()->isArchived() || version->getNode()->getLatestVersion() != version) {
+            campus_->validationUnlock();
+            abort();
+            skipped_nodes_++;
+            return 0;
+        }
+    }
+    campus_->incrementUpdateCounter();
+    int updater_id = campus_->getUpdateCounter();
+    for (Version *version : context_->getNewVersions()) {
+        campus_->switchVersion(version->getNode(), version);
+        version->setUpdaterId(updater_id);
+    }
+    campus_->validationUnlock();
+    moved_vectors_ += moved;
+    return moved;
+}
+
+Version *CampusRebalancer::getWorkingVersion(Node *node) {
+    std::vector<Version*> &new_versions = context_->getNewVersions();
+    Version *working_version = Campus::findWorkingVersion(node, new_versions);
+    if (std::find(new_versions.begin(), new_versions.end(), working_version) != new_versions.end()) {
+        return working_version;
+    }
+    Version *changed_version = working_version;
+    working_version = new Version(changed_version->getVersion() + 1, node, changed_version,
+        campus_->getPositingLimit(), campus_->getDimension(), campus_->getElementSize());
+    working_version->copyFromPrevVersion();
+    new_versions.push_back(working_version);
+    context_->getChangedVersions().push_back(changed_version);
+    return working_version;
+}
+
+void CampusRebalancer::abort() {
+    for (Version *version : context_->getNewVersions()) {
+        delete version;
+    }
+    context_->reset();
+}
@@ -0,0 +1,62 @@
+#ifndef CAMPUS_REBALANCER_H
+#define CAMPUS_REBALANCER_H
+
+#include "../utils/periodic_worker.h"
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <utility>
+
+class Campus;
+class CampusContext;
+class Node;
+class Version;
+
+// Moves misassigned vectors, primaries closer to a neighbor's centroid than to their own, back
+// where they belong. Splits and drifting centroids leave such vectors behind over time, and a
+// query probing the right posting then misses them.
+// A pass samples sample_size random live nodes and checks their primaries against the centroids
+// of the nodes within two hops in the graph only, so it costs O(sample_size * posting_limit *
+// degree^2) instead of the O(N * M) of Campus::countViolateVectors(). Each sampled node is fixed in its own small
+// transaction: the moved vectors leave the node and join neighbors that have room (a move never
+// splits). The validation lock is only tried once, so the rebalancer gives way to foreground
+// commits, and a pass stops after max_moves moves.
+class CampusRebalancer {
+public:
+    CampusRebalancer(Campus *campus, int sample_size, int max_moves);
+    ~CampusRebalancer();
+
+    CampusRebalancer(const CampusRebalancer&) = delete;
+    CampusRebalancer &operator=(const CampusRebalancer&) = delete;
+
+    // Run a pass every interval on a background thread until the rebalancer is destroyed.
+    void start(std::chrono::milliseconds interval);
+    // Run one pass on the calling thread. Returns the number of vectors moved.
+    int rebalance();
+
+    long getSampledNodes() const { return sampled_nodes_.load(); }
+    long getMovedVectors() const { return moved_vectors_.load(); }
+    // transactions given up on a busy validation lock or a concurrent change
+    long getSkippedNodes() const { return skipped_nodes_.load(); }
+
+private:
+    Campus *campus_;
+    const int sample_size_;
+    const int max_moves_;
+    CampusContext *context_; // distance and transaction buffers of the passes
+    std::atomic<long> sampled_nodes_;
+    std::atomic<long> moved_vectors_;
+    std::atomic<long> skipped_nodes_;
+    std::mutex pass_mutex_; // one pass at a time
+    std::mt19937 rng_;
+    PeriodicWorker *worker_;
+    std::vector<std::pair<int, Node*>> moves_; // (posting index, target) of the current rebalanceNode()
+
+    int rebalanceNode(Node *node, int move_limit);
+    Version *getWorkingVersion(Node *node);
+    void abort();
+};
+
+#endif //CAMPUS_REBALANCER_H
@@ -0,0 +1,81 @@
+#ifndef CAMPUS_TOMBSTONE_H
+#define CAMPUS_TOMBSTONE_H
+
+#include <atomic>
+#include <cstdint>
+
+// Ids of deleted vectors, one bit per id.
+// The bits live in fixed-size chunks that are allocated on the first delete in their id range,
+// so the table is sharded by id and neither writers nor readers take a lock: a lookup is
+// two loads. Negative ids are never deleted.
+class TombstoneTable {
+public:
+    TombstoneTable() : chunks_(new std::atomic<std::atomic<uint64_t>*>[MAX_CHUNKS]), size_(0) {
+        for (int i = 0; i < MAX_CHUNKS; ++i) {
+            chunks_[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~TombstoneTable() {
+        for (int i = 0; i < MAX_CHUNKS; ++i) {
+            delete[] chunks_[i].load(std::memory_order_relaxed);
+        }
+        delete[] chunks_;
+    }
+
+    TombstoneTable(const TombstoneTable&) = delete;
+    TombstoneTable &operator=(const TombstoneTable&) = delete;
+
+    // Returns false if id was already deleted or is negative.
+    bool add(int id) {
+        if (id < 0) {
+            return false;
+        }
+        std::atomic<uint64_t> *chunk = chunks_[id >> CHUNK_BITS].load(std::memory_order_acquire);
+        if (chunk == nullptr) {
+            std::atomic<uint64_t> *new_chunk = new std::atomic<uint64_t>[CHUNK_WORDS];
+            for (int i = 0; i < CHUNK_WORDS; ++i) {
+                new_chunk[i].store(0, std::memory_order_relaxed);
+            }
+            if (chunks_[id >> CHUNK_BITS].compare_exchange_strong(chunk, new_chunk, std::memory_order_acq_rel)) {
+                chunk = new_chunk;
+            } else {
+                // another writer installed the chunk first; chunk now holds it
+                delete[] new_chunk;
+            }
+        }
+        uint64_t mask = uint64_t(1) << (id & 63);
+        uint64_t old_word = chunk[(id & CHUNK_MASK) >> 6].fetch_or(mask, std::memory_order_acq_rel);
+        if (old_word & mask) {
+            return false;
+        }
+        size_.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    bool contains(int id) const {
+        if (id < 0) {
+            return false;
+        }
+        std::atomic<uint64_t> *chunk = chunks_[id >> CHUNK_BITS].load(std::memory_order_acquire);
+        if (chunk == nullptr) {
+            return false;
+        }
+        return (chunk[(id & CHUNK_MASK) >> 6].load(std::memory_order_acquire) >> (id & 63)) & 1;
+    }
+
+    // Scans skip the lookups while nothing is deleted.
+    long size() const { return size_.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+
+private:
+    static const int CHUNK_BITS = 16; // 65536 ids, 8KB per chunk
+    static const int CHUNK_MASK = (1 << CHUNK_BITS) - 1;
+    static const int CHUNK_WORDS = (1 << CHUNK_BITS) / 64;
+    static const int MAX_CHUNKS = 1 << (31 - CHUNK_BITS); // covers every non-negative int
+
+    std::atomic<std::atomic<uint64_t>*> *chunks_;
+    std::atomic<long> size_;
+};
+
+#endif //CAMPUS_TOMBSTONE_H
@@ -4,28 +4,56 @@
 
 
 void Version::calculateCentroid() {
-    if (vector_num_ == 0) {
-        std::memset(centroid, 0, dimension_ * element_size_);
-        return;
-    }
-
-    std::memset(centroid, 0, dimension_ * element_size_);
+    std::memset(centroid_sum_, 0, dimension_ * sizeof(double));
     for (int i = 0; i < vector_num_; ++i) {
+        if (posting_[i]->is_replica) {
+            continue;
+        }
         const float* vec = static_cast<const float*>(posting_[i]->getVector());
         for (int j = 0; j < dimension_; ++j) {
-            reinterpret_cast<float*>(centroid)[j] += vec[j];
+            centroid_sum_[j] += vec[j];
         }
     }
+    drift_updates_ = 0;
 
+    if (primary_num_ == 0) {
+        std::memset(centroid, 0, dimension_ * element_size_);
+        return;
+    }
     for (int j = 0; j < dimension_; ++j) {
-        reinterpret_cast<float*>(centroid)[j] /= vector_num_;
+        reinterpret_cast<float*>(centroid)[j] = centroid_sum_[j] / primary_num_;
     }
 }
 
-void Version::addVector(const void* vector, const int vector_id) {
+void Version::addToCentroid(const void *vector, double sign) {
+    // O(dimension) update; refresh exactly once every max_num_ updates to bound the drift
+    if (++drift_updates_ >= max_num_) {
+        calculateCentroid();
+        return;
+    }
+    const float* vec = static_cast<const float*>(vector);
+    for (int j = 0; j < dimension_; ++j) {
+        centroid_sum_[j] += sign * vec[j];
+    }
+    if (primary_num_ == 0) {
+        std::memset(centroid, 0, dimension_ * element_size_);
+        return;
+    }
+    for (int j = 0; j < dimension_; ++j) {
+        reinterpret_cast<float*>(centroid)[j] = centroid_sum_[j] / primary_num_;
+    }
+}
+
+void Version::addVector(const void* vector, const int vector_id, bool is_replica, long timestamp) {
     if (vector_num_ < max_num_) {
-        posting_[vector_num_] = new Entity(vector_id, vector, dimension_, element_size_);
+        posting_[vector_num_] = new Entity(vector_id, vector, dimension_, element_size_, is_replica, timestamp);
         vector_num_++;
+        max_timestamp_ = std::max(max_timestamp_, timestamp);
+        if (!is_replica) {
+            primary_num_++;
+            added_ids_.push_back(vector_id);
+            addToCentroid(vector, 1.0);
+        }
     }else{
         std::cout << "Can't add vector" << std::endl;
     }
@@ -33,16 +61,26 @@ void Version::addVector(const void* vector, const int vector_id) {
 
 void Version::deleteVector(int vector_id) {
     for (int i = 0; i < vector_num_; ++i) {
-        if (posting_[i]->id == vector_id) {
-            for (int j = i; j < vector_num_ - 1; ++j) {
-                posting_[j] = posting_[j + 1];
-            }
-            vector_num_--;
+        if (posting_[i]->id == vector_id && !posting_[i]->is_replica) {
+            removeEntity(i);
             break;
         }
     }
 }
 
+Entity *Version::removeEntity(int index) {
+    Entity *entity = posting_[index];
+    for (int j = index; j < vector_num_ - 1; ++j) {
+        posting_[j] = posting_[j + 1];
+    }
+    vector_num_--;
+    if (!entity->is_replica) {
+        primary_num_--;
+        addToCentroid(entity->getVector(), -1.0);
+    }
+    return entity;
+}
+
 void Version::addInNeighbor(Node* neighbor) {
     in_neighbors_.push_back(neighbor);
 }
@@ -58,9 +96,19 @@ void Version::copyFromPrevVersion() {
     }
     // copy posting
     for (int i = 0; i < prev_version_->getVectorNum(); ++i) {
-        addVector(prev_version_->getPosting()[i]->getVector(), prev_version_->getPosting()[i]->id);
+        Entity *entity = prev_version_->getPosting()[i];
+        posting_[i] = new Entity(entity->id, entity->getVector(), dimension_, element_size_, entity->is_replica, entity->timestamp);
+        max_timestamp_ = std::max(max_timestamp_, entity->timestamp);
     }
     vector_num_ = prev_version_->getVectorNum();
+    primary_num_ = prev_version_->getPrimaryNum();
+    copyGraphFromPrevVersion();
+}
+
+void Version::copyGraphFromPrevVersion() {
+    if (prev_version_ == nullptr) {
+        return;
+    }
     // copy neighbors
     for (Node* neighbor : prev_version_->getOutNeighbors()) {
         addOutNeighbor(neighbor);
@@ -70,4 +118,6 @@ void Version::copyFromPrevVersion() {
     }
     // copy centroid
     std::memcpy(centroid, prev_version_->getCentroid(), dimension_ * element_size_);
+    std::memcpy(centroid_sum_, prev_version_->centroid_sum_, dimension_ * sizeof(double));
+    drift_updates_ = prev_version_->drift_updates_;
 }
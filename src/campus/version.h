@@ -3,6 +3,7 @@
 
 #include "entity.h"
 #include <vector>
+#include <cstring>
 #include <algorithm>
 #include <iostream>
 #include <cassert>
@@ -12,10 +13,12 @@ class Node;
 class Version {
 public:
     Version(int version, Node *node, Version *prev_version, int max_num, int dimension, size_t element_size)
-        : version_(version), node_(node), prev_version_(prev_version), max_num_(max_num), vector_num_(0),
-            dimension_(dimension), element_size_(element_size) {
+        : version_(version), node_(node), prev_version_(prev_version), max_num_(max_num), vector_num_(0), primary_num_(0),
+            dimension_(dimension), element_size_(element_size), drift_updates_(0), max_timestamp_(LONG_MIN) {
         posting_ = new Entity*[max_num_];
         centroid = new char[dimension_ * element_size_];
+        centroid_sum_ = new double[dimension_]();
+        std::memset(centroid, 0, dimension_ * element_size_);
     }
 
     ~Version() {
@@ -24,16 +27,28 @@ public:
         }
         delete[] posting_;
         delete[] static_cast<char*>(centroid);
+        delete[] centroid_sum_;
     }
 
     int getVersion() const { return version_; }
+    // only valid while the version is being built; superseded versions are reclaimed, see Campus::switchVersion()
     Version *getPrevVersion() const { return prev_version_; }
     Node *getNode() const { return node_; }
     int getVectorNum() const { return vector_num_; }
+    // vectors assigned to this posting, excluding replicas
+    int getPrimaryNum() const { return primary_num_; }
     void* getCentroid() const { return centroid; }
-    std::vector<Node*> getInNeighbors() const { return in_neighbors_; }
-    std::vector<Node*> getOutNeighbors() const { return out_neighbors_; }
+    // committed versions are never modified, so readers can iterate the lists in place
+    const std::vector<Node*> &getInNeighbors() const { return in_neighbors_; }
+    const std::vector<Node*> &getOutNeighbors() const { return out_neighbors_; }
     Entity **getPosting() const { return posting_; }
+    // Upper bound of the timestamps in the posting. Deletions do not lower it; a copy recomputes it.
+    long getMaxTimestamp() const { return max_timestamp_; }
+    // ids of the primaries added by addVector() since the version was created, which are the
+    // entries a transaction moved into the node; copies from the previous version are not included
+    const std::vector<int> &getAddedIds() const { return added_ids_; }
+    // Recompute the centroid exactly from the primaries of the posting; replicas never move it.
+    // addVector/deleteVector keep it current incrementally, so this is only needed to reset drift.
     void calculateCentroid();
     void printAllVectors() {
         for (int i = 0; i < vector_num_; ++i) {
@@ -44,9 +59,16 @@ public:
         }
     }
     bool canAddVector() const { return vector_num_ < max_num_; }
-    void addVector(const void* vector, const int vector_id);
+    void addVector(const void* vector, const int vector_id, bool is_replica = false, long timestamp = Entity::NO_TIMESTAMP);
+    // Deletes the primary entry of vector_id. The entity is not freed, so a vector read from it
+    // stays valid for moving it to another posting.
     void deleteVector(int vector_id);
+    // Deletes and frees the entry at index of the posting, primary or replica. Later entries move up by one.
+    void deleteEntity(int index) { delete removeEntity(index); }
     void copyFromPrevVersion() ;
+    // Copy only the centroid and the edges, for the edge-only version of a collected node,
+    // see Campus::collectArchivedNodes().
+    void copyGraphFromPrevVersion();
     void addInNeighbor(Node* neighbor);
     void deleteInNeighbor(Node* neighbor) {
         in_neighbors_.erase(std::remove(in_neighbors_.begin(), in_neighbors_.end(), neighbor), in_neighbors_.end());
@@ -64,13 +86,21 @@ private:
     Version *prev_version_;
     const int max_num_;
     int vector_num_;
+    int primary_num_;
     const int dimension_;
     int updater_id_;
     const size_t element_size_;
     std::vector<Node*> in_neighbors_;
     std::vector<Node*> out_neighbors_;
     void *centroid;
+    double *centroid_sum_; // running sum of the posting, kept in double to limit drift
+    int drift_updates_; // incremental updates since the last exact calculation
+    long max_timestamp_;
+    std::vector<int> added_ids_;
     Entity **posting_;
+
+    void addToCentroid(const void *vector, double sign);
+    Entity *removeEntity(int index);
 };
 
 #endif //CAMPUS_VERSION_H
\ No newline at end of file
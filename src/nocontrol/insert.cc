@@ -4,7 +4,7 @@
 void NoControlInsertExecutor::insert(){
 RETRY:
     if (nocontrol_->getNodeNum()==0){
-        Node *new_node = new Node(10, 10, sizeof(float));
+        Node *new_node = new Node(10, 10, sizeof(float), nocontrol_->newNodeSlot());
         nocontrol_->addNode(new_node);
         nocontrol_->incrementNodeNum();
         nocontrol_->setEntryPoint(new_node);
@@ -21,8 +21,8 @@ RETRY:
 }
 
 void NoControlInsertExecutor::split(Node *spliting_node, const void *insert_vector, const int vector_id){
-    Node *new_node1 = new Node(10, 10, sizeof(float));
-    Node *new_node2 = new Node(10, 10, sizeof(float));
+    Node *new_node1 = new Node(10, 10, sizeof(float), nocontrol_->newNodeSlot());
+    Node *new_node2 = new Node(10, 10, sizeof(float), nocontrol_->newNodeSlot());
     nocontrol_->addNode(new_node1);
     nocontrol_->addNode(new_node2);
     nocontrol_->deleteNode(spliting_node);
@@ -1,6 +1,6 @@
 #include "nocontrol.h"
+#include "../utils/visited.h"
 #include <queue>
-#include <unordered_set>
 #include <cassert>
 
 Node *NoControl::findExactNearestNode(const void *query_vector, Distance *distance) {
@@ -26,7 +26,8 @@ Node *NoControl::findExactNearestNode(const void *query_vector, Distance *distan
 
 std::vector<Node*> NoControl::findNearestNodes(const void *query_vector, Distance *distance, int n) {
     std::priority_queue<std::pair<float, Node*>> pq;
-    std::unordered_set<Node*> visited;
+    thread_local VisitedTable visited;
+    visited.reset();
 
     if (entry_point_ == nullptr) {
         return {};
@@ -38,10 +39,9 @@ std::vector<Node*> NoControl::findNearestNodes(const void *query_vector, Distanc
         Node *current_node = pq.top().second;
         pq.pop();
 
-        if (visited.find(current_node) != visited.end()) {
+        if (!visited.visit(current_node->getSlot())) {
             continue;
         }
-        visited.insert(current_node);
 
         float current_distance = distance->calculateDistance(static_cast<const float*>(current_node->getCentroid()), static_cast<const float*>(query_vector), dimension_);
 
@@ -54,7 +54,7 @@ std::vector<Node*> NoControl::findNearestNodes(const void *query_vector, Distanc
 
         // Explore neighbors
         for (Node* neighbor_node : current_node->getOutNeighbors()) {
-            if (visited.find(neighbor_node) == visited.end()) {
+            if (!visited.isVisited(neighbor_node->getSlot())) {
                 pq.push(std::make_pair(current_distance, neighbor_node));
             }
         }
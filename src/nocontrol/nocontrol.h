@@ -7,6 +7,7 @@
 #include <vector>
 #include <mutex>
 #include <memory>
+#include <atomic>
 #include <algorithm>
 
 class NoControl {
@@ -17,8 +18,8 @@ public:
     };
 
     NoControl(int dimension, int posting_limit, int connection_limit, DistanceType distance_type, size_t element_size)
-        : dimension_(dimension), posting_limit_(posting_limit), connection_limit_(connection_limit), distance_type_(distance_type), element_size_(element_size), node_num_(0) {
-        entry_point_ = new Node(10, 10, sizeof(float));
+        : dimension_(dimension), posting_limit_(posting_limit), connection_limit_(connection_limit), distance_type_(distance_type), element_size_(element_size), node_num_(0), slot_counter_(0) {
+        entry_point_ = new Node(10, 10, sizeof(float), newNodeSlot());
     }
 
     ~NoControl() {
@@ -35,6 +36,7 @@ public:
     std::vector<Node*> findNearestNodes(const void *query_vector, Distance *distance, int n);
     DistanceType getDistanceType() const { return distance_type_; }
     void incrementNodeNum() { node_num_++; }
+    int newNodeSlot() { return slot_counter_++; }
     void addNode(Node *node) {
         std::lock_guard<std::mutex> lock(mutex_);
         auto new_nodes = std::make_shared<std::vector<Node*>>(*all_nodes_);
@@ -55,6 +57,7 @@ private:
     size_t element_size_;
     Node *entry_point_;
     int node_num_;
+    std::atomic<int> slot_counter_;
     std::mutex mutex_;
     std::shared_ptr<std::vector<Node*>> all_nodes_ = std::make_shared<std::vector<Node*>>();
 };
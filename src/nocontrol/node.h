@@ -7,9 +7,10 @@
 
 class Node {
 public:
-    Node(int max_num, int dimension, size_t element_size)
+    // slot is a dense id handed out by NoControl::newNodeSlot(), used to index visited tables
+    Node(int max_num, int dimension, size_t element_size, int slot)
         : max_num_(max_num), dimension_(dimension), element_size_(element_size),
-        vector_num_(0)
+        vector_num_(0), slot_(slot)
     {
         posting_ = new Entity*[max_num_];
         centroid = new char[dimension_ * element_size_];
@@ -21,6 +22,7 @@ public:
     void addVector(const void *vector, const int vector_id);
     void deleteVector(int vector_id);
     int getVectorNum() const { return vector_num_; }
+    int getSlot() const { return slot_; }
     void *getCentroid() const { return centroid; }
     std::vector<Node*> getInNeighbors() const { return in_neighbors_; }
     std::vector<Node*> getOutNeighbors() const { return out_neighbors_; }
@@ -38,6 +40,7 @@ private:
     const int max_num_;
     const int dimension_;
     const size_t element_size_;
+    const int slot_;
     void *centroid;
     Entity **posting_;
 };
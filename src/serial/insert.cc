@@ -1,7 +1,6 @@
 #include "serial.h"
 #include <cassert>
 #include <iostream>
-#include <unordered_set>
 
 
 void SerialInsertExecutor::insert(){
@@ -9,7 +8,7 @@ void SerialInsertExecutor::insert(){
     // If the campus is empty, create a new node and set it as the entry point
     if (serial_->getNodeNum() == 0){
         Node *new_node = new Node(serial_->getPositingLimit(),
-            serial_->getDimension(), sizeof(float));
+            serial_->getDimension(), sizeof(float), serial_->newNodeSlot());
         serial_->setEntryPoint(new_node);
         serial_->addNode(new_node);
         serial_->incrementNodeNum();
@@ -32,9 +31,9 @@ void SerialInsertExecutor::insert(){
 
 void SerialInsertExecutor::split(Node *spliting_node, const void *insert_vector, int vector_id) {
     Node *new_node1 = new Node(serial_->getPositingLimit(),
-        serial_->getDimension(), serial_->getElementSize());
+        serial_->getDimension(), serial_->getElementSize(), serial_->newNodeSlot());
     Node *new_node2 = new Node(serial_->getPositingLimit(),
-        serial_->getDimension(), serial_->getElementSize());
+        serial_->getDimension(), serial_->getElementSize(), serial_->newNodeSlot());
     serial_->incrementNodeNum();
     serial_->addNode(new_node1);
     serial_->addNode(new_node2);
@@ -276,14 +275,19 @@ void SerialInsertExecutor::reassignCalculation(Node *spliting_node, Node *new_no
     }
 
 
-    std::unordered_set<Node*> in_neighbors_set;
+    thread_local VisitedTable visited;
+    visited.reset();
+    std::vector<Node*> in_neighbors;
     for (Node *neighbor_node : new_node1->getInNeighbors()) {
-        in_neighbors_set.insert(neighbor_node);
+        if (visited.visit(neighbor_node->getSlot())) {
+            in_neighbors.push_back(neighbor_node);
+        }
     }
     for (Node *neighbor_node : new_node2->getInNeighbors()) {
-        in_neighbors_set.insert(neighbor_node);
+        if (visited.visit(neighbor_node->getSlot())) {
+            in_neighbors.push_back(neighbor_node);
+        }
     }
-    std::vector<Node*> in_neighbors(in_neighbors_set.begin(), in_neighbors_set.end());
 
     for (Node* neighbor_node : in_neighbors){
         if (neighbor_node == new_node1 || neighbor_node == new_node2) {
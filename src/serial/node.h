@@ -8,8 +8,9 @@
 
 class Node {
 public:
-    Node(int max_num, int dimension, size_t element_size)
-        : max_num_(max_num), vector_num_(0), dimension_(dimension), element_size_(element_size) {
+    // slot is a dense id handed out by Serial::newNodeSlot(), used to index visited tables
+    Node(int max_num, int dimension, size_t element_size, int slot)
+        : max_num_(max_num), vector_num_(0), dimension_(dimension), element_size_(element_size), slot_(slot) {
         posting_ = new Entity*[max_num_];
         centroid = new char[dimension_ * element_size_];
     }
@@ -23,6 +24,7 @@ public:
     }
 
     int getVectorNum() const { return vector_num_; }
+    int getSlot() const { return slot_; }
     void* getCentroid() const { return centroid; }
     std::vector<Node*> getInNeighbors() const { return in_neighbors_; }
     std::vector<Node*> getOutNeighbors() const { return out_neighbors_; }
@@ -46,6 +48,7 @@ private:
     int vector_num_;
     const int dimension_;
     const size_t element_size_;
+    const int slot_;
     std::vector<Node*> in_neighbors_;
     std::vector<Node*> out_neighbors_;
     void *centroid;
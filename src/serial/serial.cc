@@ -4,7 +4,6 @@
 #include <limits>
 #include <algorithm>
 #include <iostream>
-#include <unordered_set>
 
 
 Node *Serial::findExactNearestNode(const void *query_vector, Distance *distance) {
@@ -51,7 +50,8 @@ std::vector<Node*> Serial::findExactNearestNodes(const void *query_vector, Dista
 std::vector<Node*> Serial::findNearestNodes(const void *query_vector, Distance *distance, int node_num, int pq_size) {
     using NodeDistance = std::pair<float, Node*>;
     std::vector<NodeDistance> search_candidates;
-    std::unordered_set<Node*> visited;
+    thread_local VisitedTable visited;
+    visited.reset();
 
     if (entry_point_ == nullptr) return {};
     float distance_to_entry = distance->calculateDistance(static_cast<const float*>(entry_point_->getCentroid()), static_cast<const float*>(query_vector), dimension_);
@@ -60,15 +60,14 @@ std::vector<Node*> Serial::findNearestNodes(const void *query_vector, Distance *
     while(true) {
         bool updated = false;
         for (NodeDistance current : search_candidates) {
-            if (visited.find(current.second) != visited.end()) {
+            if (!visited.visit(current.second->getSlot())) {
                 continue;
             }
-            visited.insert(current.second);
 
             for (Node *neighbor : current.second->getOutNeighbors()) {
                 assert(neighbor != nullptr);
                 float distance_to_neighbor = distance->calculateDistance(static_cast<const float*>(neighbor->getCentroid()), static_cast<const float*>(query_vector), dimension_);
-                if (visited.find(neighbor) != visited.end()) {
+                if (visited.isVisited(neighbor->getSlot())) {
                     continue;
                 }
                 // insert neighbor to search_candidates which is sorted by distance
@@ -4,6 +4,7 @@
 #include "node.h"
 #include "../utils/distance.h"
 #include "../utils/lock.h"
+#include "../utils/visited.h"
 #include <vector>
 #include <unordered_set>
 
@@ -16,7 +17,7 @@ public:
 
     Serial(int dimension, int posting_limit, int connection_limit, DistanceType distance_type, size_t element_size)
         : dimension_(dimension), posting_limit_(posting_limit), connection_limit_(connection_limit), node_num_(0),
-            update_counter_(0), distance_type_(distance_type), element_size_(element_size), entry_point_(nullptr){}
+            update_counter_(0), distance_type_(distance_type), element_size_(element_size), entry_point_(nullptr), slot_counter_(0) {}
 
     ~Serial() {
 
@@ -38,6 +39,7 @@ public:
     void insertUnlock() { return insert_lock_.w_unlock(); }
     void setEntryPoint(Node *node) { entry_point_ = node; }
     void incrementNodeNum() { node_num_++; }
+    int newNodeSlot() { return slot_counter_++; }
     void addNode(Node *node) { all_nodes_.push_back(node); }
     void deleteNode(Node *node) {
         all_nodes_.erase(std::remove(all_nodes_.begin(), all_nodes_.end(), node), all_nodes_.end());
@@ -86,6 +88,7 @@ private:
     Node *entry_point_;
     DistanceType distance_type_;
     std::vector<Node*> all_nodes_;
+    int slot_counter_;
 
 };
 
@@ -1,9 +1,27 @@
 #include "distance.h"
 #include <cmath>
 #include <cstring>
+#include <vector>
+#include <algorithm>
 
 Distance::Distance() {}
 
+void Distance::calculateDistances(const void *const *queries, size_t query_num, const void *vectors, size_t vector_num,
+    size_t dimension, float *distances) {
+    const float *pVectors = static_cast<const float*>(vectors);
+    for (size_t q = 0; q < query_num; ++q) {
+        for (size_t v = 0; v < vector_num; ++v) {
+            distances[q * vector_num + v] = calculateDistance(queries[q], pVectors + v * dimension, dimension);
+        }
+    }
+}
+
+namespace {
+// Queries are processed in blocks of this size, so every vector row is loaded once per block
+// and the partial sums of the block stay in registers.
+const size_t QUERY_BLOCK = 4;
+}
+
 L2Distance::L2Distance() {}
 
 float L2Distance::calculateDistance(const void *vector1, const void *vector2, size_t dimension) {
@@ -18,6 +36,43 @@ float L2Distance::calculateDistance(const void *vector1, const void *vector2, si
     return res;
 }
 
+void L2Distance::calculateDistances(const void *const *queries, size_t query_num, const void *vectors, size_t vector_num,
+    size_t dimension, float *distances) {
+    const float *pVectors = static_cast<const float*>(vectors);
+    size_t q = 0;
+    for (; q + QUERY_BLOCK <= query_num; q += QUERY_BLOCK) {
+        const float *q0 = static_cast<const float*>(queries[q]);
+        const float *q1 = static_cast<const float*>(queries[q + 1]);
+        const float *q2 = static_cast<const float*>(queries[q + 2]);
+        const float *q3 = static_cast<const float*>(queries[q + 3]);
+        for (size_t v = 0; v < vector_num; ++v) {
+            const float *pVect = pVectors + v * dimension;
+            // same summation order as calculateDistance, so the results are identical
+            float res0 = 0, res1 = 0, res2 = 0, res3 = 0;
+            for (size_t i = 0; i < dimension; i++) {
+                float x = pVect[i];
+                float diff0 = q0[i] - x;
+                float diff1 = q1[i] - x;
+                float diff2 = q2[i] - x;
+                float diff3 = q3[i] - x;
+                res0 += diff0 * diff0;
+                res1 += diff1 * diff1;
+                res2 += diff2 * diff2;
+                res3 += diff3 * diff3;
+            }
+            distances[q * vector_num + v] = res0;
+            distances[(q + 1) * vector_num + v] = res1;
+            distances[(q + 2) * vector_num + v] = res2;
+            distances[(q + 3) * vector_num + v] = res3;
+        }
+    }
+    for (; q < query_num; ++q) {
+        for (size_t v = 0; v < vector_num; ++v) {
+            distances[q * vector_num + v] = calculateDistance(queries[q], pVectors + v * dimension, dimension);
+        }
+    }
+}
+
 AngularDistance::AngularDistance() {}
 
 float AngularDistance::calculateDistance(const void *vector1, const void *vector2, size_t dimension) {
@@ -33,4 +88,44 @@ float AngularDistance::calculateDistance(const void *vector1, const void *vector
         norm2 += pVect2[i] * pVect2[i];
     }
     return std::acos(dot_product / (std::sqrt(norm1) * std::sqrt(norm2)));
-}
\ No newline at end of file
+}
+
+void AngularDistance::calculateDistances(const void *const *queries, size_t query_num, const void *vectors, size_t vector_num,
+    size_t dimension, float *distances) {
+    const float *pVectors = static_cast<const float*>(vectors);
+    // norms are computed once per row and once per query instead of once per pair
+    std::vector<float> vector_norms(vector_num);
+    for (size_t v = 0; v < vector_num; ++v) {
+        const float *pVect = pVectors + v * dimension;
+        float norm = 0.0;
+        for (size_t i = 0; i < dimension; i++) {
+            norm += pVect[i] * pVect[i];
+        }
+        vector_norms[v] = std::sqrt(norm);
+    }
+    for (size_t q = 0; q < query_num; q += QUERY_BLOCK) {
+        size_t block = std::min(QUERY_BLOCK, query_num - q);
+        const float *pQueries[QUERY_BLOCK];
+        float query_norms[QUERY_BLOCK];
+        for (size_t b = 0; b < block; ++b) {
+            pQueries[b] = static_cast<const float*>(queries[q + b]);
+            float norm = 0.0;
+            for (size_t i = 0; i < dimension; i++) {
+                norm += pQueries[b][i] * pQueries[b][i];
+            }
+            query_norms[b] = std::sqrt(norm);
+        }
+        for (size_t v = 0; v < vector_num; ++v) {
+            const float *pVect = pVectors + v * dimension;
+            float dot_products[QUERY_BLOCK] = {0};
+            for (size_t i = 0; i < dimension; i++) {
+                for (size_t b = 0; b < block; ++b) {
+                    dot_products[b] += pQueries[b][i] * pVect[i];
+                }
+            }
+            for (size_t b = 0; b < block; ++b) {
+                distances[(q + b) * vector_num + v] = std::acos(dot_products[b] / (query_norms[b] * vector_norms[v]));
+            }
+        }
+    }
+}
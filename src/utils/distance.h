@@ -8,18 +8,26 @@ public:
     Distance();
     virtual ~Distance() {}
     virtual float calculateDistance(const void *vector1, const void *vector2, size_t dimension) = 0;
+    // Distances between every query and every row of a contiguous block of vectors,
+    // written to distances[query * vector_num + vector].
+    virtual void calculateDistances(const void *const *queries, size_t query_num, const void *vectors, size_t vector_num,
+        size_t dimension, float *distances);
 };
 
 class L2Distance : public Distance {
 public:
     L2Distance();
     float calculateDistance(const void *vector1, const void *vector2, size_t dimension);
+    void calculateDistances(const void *const *queries, size_t query_num, const void *vectors, size_t vector_num,
+        size_t dimension, float *distances);
 };
 
 class AngularDistance : public Distance {
 public:
     AngularDistance();
     float calculateDistance(const void *vector1, const void *vector2, size_t dimension);
+    void calculateDistances(const void *const *queries, size_t query_num, const void *vectors, size_t vector_num,
+        size_t dimension, float *distances);
 };
 
 #endif //DISTANCE_H
\ No newline at end of file
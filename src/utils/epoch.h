@@ -0,0 +1,93 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+
+// Epoch-based reclamation. Operations pin the current epoch while they read shared objects;
+// an object unlinked while the epoch is e is retired with tag e and freed once advance()
+// reports that every operation that could still see it has finished.
+// Pins are counted per epoch parity, spread over cache-line sized stripes so that concurrent
+// readers do not share a counter. enter/exit may be called from any thread and nest;
+// advance() must be serialized by the caller.
+class EpochManager {
+public:
+    EpochManager() : epoch_(1) {
+        for (int parity = 0; parity < 2; ++parity) {
+            for (int stripe = 0; stripe < STRIPES; ++stripe) {
+                active_[parity][stripe].count.store(0);
+            }
+        }
+    }
+
+    // Pin the current epoch; pass the result to exit().
+    long enter() {
+        Counter &counter_0 = active_[0][stripe()];
+        Counter &counter_1 = active_[1][stripe()];
+        for (;;) {
+            long epoch = epoch_.load();
+            Counter &counter = (epoch & 1) ? counter_1 : counter_0;
+            counter.count++;
+            if (epoch_.load() == epoch) {
+                return epoch;
+            }
+            // raced with advance(); the old epoch may already be considered drained
+            counter.count--;
+        }
+    }
+
+    void exit(long epoch) { active_[epoch & 1][stripe()].count--; }
+
+    long current() const { return epoch_.load(); }
+
+    // Move to the next epoch if no operation pinned the previous one is left. Returns the newest
+    // tag whose objects can be freed: objects retired in that epoch or earlier are unreachable.
+    long advance() {
+        long epoch = epoch_.load();
+        if (activeNum((epoch - 1) & 1) != 0) {
+            return epoch - 2;
+        }
+        epoch_.store(epoch + 1);
+        return epoch - 1;
+    }
+
+private:
+    static const int STRIPES = 16;
+
+    struct alignas(64) Counter {
+        std::atomic<long> count;
+    };
+
+    std::atomic<long> epoch_;
+    Counter active_[2][STRIPES];
+
+    long activeNum(int parity) const {
+        long count = 0;
+        for (int stripe = 0; stripe < STRIPES; ++stripe) {
+            count += active_[parity][stripe].count.load();
+        }
+        return count;
+    }
+
+    // the same stripe for a thread across enter() and exit()
+    static int stripe() {
+        static std::atomic<int> next_stripe(0);
+        thread_local int stripe = next_stripe++ % STRIPES;
+        return stripe;
+    }
+};
+
+// Pins the current epoch for the lifetime of the guard.
+class EpochGuard {
+public:
+    explicit EpochGuard(EpochManager &epochs) : epochs_(epochs), epoch_(epochs.enter()) {}
+    ~EpochGuard() { epochs_.exit(epoch_); }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard &operator=(const EpochGuard&) = delete;
+
+private:
+    EpochManager &epochs_;
+    const long epoch_;
+};
+
+#endif //EPOCH_H
@@ -0,0 +1,151 @@
+#include "kmeans.h"
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <unordered_set>
+
+namespace {
+// vectors per assignment task
+const size_t ASSIGN_CHUNK = 256;
+}
+
+void assignBalanced(const float *distances, size_t vector_num, int k, size_t max_size, std::vector<int> &labels) {
+    max_size = std::max(max_size, (vector_num + k - 1) / k);
+    std::vector<std::pair<float, size_t>> order(vector_num);
+    for (size_t i = 0; i < vector_num; ++i) {
+        const float *row = distances + i * k;
+        float nearest = std::numeric_limits<float>::max();
+        float second = std::numeric_limits<float>::max();
+        for (int c = 0; c < k; ++c) {
+            if (row[c] < nearest) {
+                second = nearest;
+                nearest = row[c];
+            } else if (row[c] < second) {
+                second = row[c];
+            }
+        }
+        order[i] = std::make_pair(k > 1 ? nearest - second : 0.0f, i);
+    }
+    // most negative first: the largest gap
+    std::sort(order.begin(), order.end());
+    std::vector<size_t> sizes(k, 0);
+    labels.resize(vector_num);
+    for (const std::pair<float, size_t> &entry : order) {
+        const float *row = distances + entry.second * k;
+        int best = -1;
+        for (int c = 0; c < k; ++c) {
+            if (sizes[c] < max_size && (best < 0 || row[c] < row[best])) {
+                best = c;
+            }
+        }
+        labels[entry.second] = best;
+        sizes[best]++;
+    }
+}
+
+int kmeans(const void *const *vectors, size_t vector_num, int dimension, int k, int max_iterations, unsigned seed,
+    Distance *distance, ThreadPool *pool, std::vector<float> &centers, std::vector<int> &labels, size_t max_size) {
+    k = std::min<size_t>(k, vector_num);
+    centers.assign(static_cast<size_t>(k) * dimension, 0);
+    labels.assign(vector_num, -1);
+    if (k == 0) {
+        return 0;
+    }
+
+    // Floyd's sampling: k distinct seeds without shuffling all indices
+    std::mt19937 rng(seed);
+    std::unordered_set<size_t> seeds;
+    for (size_t j = vector_num - k; j < vector_num; ++j) {
+        size_t candidate = std::uniform_int_distribution<size_t>(0, j)(rng);
+        seeds.insert(seeds.count(candidate) ? j : candidate);
+    }
+    int c = 0;
+    for (size_t seed_index : seeds) {
+        const float *vector = static_cast<const float*>(vectors[seed_index]);
+        std::copy(vector, vector + dimension, centers.begin() + static_cast<size_t>(c++) * dimension);
+    }
+
+    int worker_num = pool != nullptr ? pool->getWorkerNum() : 1;
+    std::vector<std::vector<double>> sums(worker_num);
+    std::vector<std::vector<long>> counts(worker_num);
+    std::vector<std::vector<float>> distances(worker_num);
+    std::vector<long> changed(worker_num);
+    int chunk_num = (vector_num + ASSIGN_CHUNK - 1) / ASSIGN_CHUNK;
+    // balanced rounds keep all distances for assignBalanced() and sum up afterwards
+    std::vector<float> all_distances(max_size > 0 ? vector_num * k : 0);
+    std::vector<int> balanced_labels;
+    auto addToSum = [&](int worker, size_t i, int label) {
+        if (labels[i] != label) {
+            labels[i] = label;
+            changed[worker]++;
+        }
+        const float *vector = static_cast<const float*>(vectors[i]);
+        double *sum = sums[worker].data() + static_cast<size_t>(label) * dimension;
+        for (int j = 0; j < dimension; ++j) {
+            sum[j] += vector[j];
+        }
+        counts[worker][label]++;
+    };
+    auto assign = [&](int worker, int chunk) {
+        size_t begin = static_cast<size_t>(chunk) * ASSIGN_CHUNK;
+        size_t size = std::min(ASSIGN_CHUNK, vector_num - begin);
+        if (max_size > 0) {
+            distance->calculateDistances(vectors + begin, size, centers.data(), k, dimension, all_distances.data() + begin * k);
+            return;
+        }
+        std::vector<float> &chunk_distances = distances[worker];
+        chunk_distances.resize(size * k);
+        distance->calculateDistances(vectors + begin, size, centers.data(), k, dimension, chunk_distances.data());
+        for (size_t q = 0; q < size; ++q) {
+            const float *row = chunk_distances.data() + q * k;
+            addToSum(worker, begin + q, std::min_element(row, row + k) - row);
+        }
+    };
+
+    int iteration = 0;
+    while (iteration < max_iterations) {
+        iteration++;
+        for (int worker = 0; worker < worker_num; ++worker) {
+            sums[worker].assign(static_cast<size_t>(k) * dimension, 0);
+            counts[worker].assign(k, 0);
+            changed[worker] = 0;
+        }
+        if (pool != nullptr) {
+            pool->parallelFor(chunk_num, assign);
+        } else {
+            for (int chunk = 0; chunk < chunk_num; ++chunk) {
+                assign(0, chunk);
+            }
+        }
+        if (max_size > 0) {
+            assignBalanced(all_distances.data(), vector_num, k, max_size, balanced_labels);
+            for (size_t i = 0; i < vector_num; ++i) {
+                addToSum(0, i, balanced_labels[i]);
+            }
+        }
+        long changed_num = 0;
+        for (int worker = 1; worker < worker_num; ++worker) {
+            for (size_t j = 0; j < sums[0].size(); ++j) {
+                sums[0][j] += sums[worker][j];
+            }
+            for (int center = 0; center < k; ++center) {
+                counts[0][center] += counts[worker][center];
+            }
+        }
+        for (int worker = 0; worker < worker_num; ++worker) {
+            changed_num += changed[worker];
+        }
+        if (changed_num == 0) {
+            break;
+        }
+        for (int center = 0; center < k; ++center) {
+            if (counts[0][center] == 0) {
+                continue;
+            }
+            for (int j = 0; j < dimension; ++j) {
+                centers[static_cast<size_t>(center) * dimension + j] = sums[0][static_cast<size_t>(center) * dimension + j] / counts[0][center];
+            }
+        }
+    }
+    return iteration;
+}
@@ -0,0 +1,26 @@
+#ifndef KMEANS_H
+#define KMEANS_H
+
+#include "distance.h"
+#include "thread_pool.h"
+#include <vector>
+#include <cstddef>
+
+// Lloyd's k-means over float vectors, seeded with k distinct vectors drawn with seed.
+// The assignment step runs the batched distance kernel over all centers, split over the
+// workers of pool (nullptr: the calling thread only); distance is shared by the workers.
+// With max_size, every cluster is capped at that many vectors (raised to vector_num / k if
+// smaller) by assignBalanced(); this keeps the vector_num * k distances of a round in memory.
+// Afterwards centers holds k * dimension floats and labels the center of every vector.
+// A center that loses all its vectors keeps its last position.
+// Returns the number of iterations run, at most max_iterations.
+int kmeans(const void *const *vectors, size_t vector_num, int dimension, int k, int max_iterations, unsigned seed,
+    Distance *distance, ThreadPool *pool, std::vector<float> &centers, std::vector<int> &labels, size_t max_size = 0);
+
+// Size-constrained assignment of vector_num vectors to k centers, given their distances
+// (distances[vector * k + center]). Every vector goes to the nearest center that still holds
+// fewer than max_size vectors (raised to vector_num / k if smaller). Vectors that lose most by
+// moving, by the gap between their nearest and second nearest center, choose first.
+void assignBalanced(const float *distances, size_t vector_num, int k, size_t max_size, std::vector<int> &labels);
+
+#endif //KMEANS_H
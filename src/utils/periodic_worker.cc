@@ -0,0 +1,23 @@
+#include "periodic_worker.h"
+
+
+PeriodicWorker::PeriodicWorker(std::chrono::milliseconds interval, std::function<void()> fn)
+    : interval_(interval), fn_(std::move(fn)), stop_(false), thread_(&PeriodicWorker::loop, this) {}
+
+PeriodicWorker::~PeriodicWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+void PeriodicWorker::loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!cv_.wait_for(lock, interval_, [this] { return stop_; })) {
+        lock.unlock();
+        fn_();
+        lock.lock();
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef PERIODIC_WORKER_H
+#define PERIODIC_WORKER_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
+// Background thread that calls fn every interval until it is destroyed.
+// The destructor wakes the thread up and waits for a running call to return.
+class PeriodicWorker {
+public:
+    PeriodicWorker(std::chrono::milliseconds interval, std::function<void()> fn);
+    ~PeriodicWorker();
+
+    PeriodicWorker(const PeriodicWorker&) = delete;
+    PeriodicWorker &operator=(const PeriodicWorker&) = delete;
+
+private:
+    const std::chrono::milliseconds interval_;
+    const std::function<void()> fn_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_;
+    std::thread thread_;
+
+    void loop();
+};
+
+#endif //PERIODIC_WORKER_H
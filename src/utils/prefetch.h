@@ -0,0 +1,24 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <cstddef>
+
+// Software prefetch hints. A prefetch never faults, so it can be issued before the pointer
+// is known to be dereferenced.
+const size_t CACHE_LINE_SIZE = 64;
+
+inline void prefetchRead(const void *address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address, 0, 3);
+#endif
+}
+
+// Prefetch every cache line of [address, address + bytes).
+inline void prefetchRange(const void *address, size_t bytes) {
+    const char *p = static_cast<const char*>(address);
+    for (size_t offset = 0; offset < bytes; offset += CACHE_LINE_SIZE) {
+        prefetchRead(p + offset);
+    }
+}
+
+#endif //PREFETCH_H
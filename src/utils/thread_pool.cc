@@ -0,0 +1,76 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+
+ThreadPool::ThreadPool(int thread_num) : stop_(false) {
+    for (int i = 0; i < thread_num; ++i) {
+        threads_.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (std::thread &thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::runTasks(Job *job, int worker) {
+    for (int task = job->next_task.fetch_add(1); task < job->task_num; task = job->next_task.fetch_add(1)) {
+        (*job->fn)(worker, task);
+    }
+}
+
+void ThreadPool::parallelFor(int task_num, const std::function<void(int, int)> &fn) {
+    if (task_num <= 1 || threads_.empty()) {
+        for (int task = 0; task < task_num; ++task) {
+            fn(0, task);
+        }
+        return;
+    }
+    Job job;
+    job.fn = &fn;
+    job.task_num = task_num;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(&job);
+    }
+    cv_.notify_all();
+
+    runTasks(&job, 0);
+    {
+        // no helper can join once the job has left the queue
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.erase(std::remove(jobs_.begin(), jobs_.end(), &job), jobs_.end());
+    }
+    // every task has been claimed; wait for the helpers still running theirs
+    while (job.active_helpers.load(std::memory_order_acquire) > 0) {
+        std::this_thread::yield();
+    }
+}
+
+void ThreadPool::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+        if (stop_) {
+            return;
+        }
+        Job *job = jobs_.front();
+        if (job->next_task.load() >= job->task_num) {
+            // fully claimed; its caller removes it once its own tasks are done
+            jobs_.pop_front();
+            continue;
+        }
+        job->active_helpers.fetch_add(1, std::memory_order_relaxed);
+        int worker = job->next_worker.fetch_add(1);
+        lock.unlock();
+        runTasks(job, worker);
+        job->active_helpers.fetch_sub(1, std::memory_order_release);
+        lock.lock();
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// Fixed set of worker threads shared by all callers.
+// parallelFor hands out tasks dynamically; the calling thread takes part as worker 0, so a call
+// still makes progress when every pool thread is busy with other callers' work.
+class ThreadPool {
+public:
+    explicit ThreadPool(int thread_num);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool &operator=(const ThreadPool&) = delete;
+
+    // Upper bound of the worker index passed to tasks, the caller included.
+    int getWorkerNum() const { return threads_.size() + 1; }
+
+    // Run fn(worker, task) for every task in [0, task_num) and wait for all of them.
+    // worker is in [0, getWorkerNum()) and unique among the threads running this call,
+    // so it can index per-worker scratch owned by the caller.
+    void parallelFor(int task_num, const std::function<void(int, int)> &fn);
+
+private:
+    struct Job {
+        const std::function<void(int, int)> *fn;
+        int task_num;
+        std::atomic<int> next_task{0};
+        std::atomic<int> next_worker{1};
+        std::atomic<int> active_helpers{0};
+    };
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job*> jobs_;
+    bool stop_;
+
+    void workerLoop();
+    static void runTasks(Job *job, int worker);
+};
+
+#endif //THREAD_POOL_H
@@ -0,0 +1,128 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <vector>
+#include <utility>
+#include <limits>
+#include <algorithm>
+
+// Keeps the k smallest (distance, id) candidates of a scan.
+// Up to SMALL_K results are kept in a fixed-capacity max-heap whose replacement is a single
+// sift-down. Larger k collect candidates below the current threshold in a buffer of up to 2k
+// entries, which is cut back to k with nth_element whenever it fills up.
+// push() rejects a candidate with one compare against getThreshold() in both modes.
+// Not thread-safe; keep one selector per thread.
+class TopKSelector {
+public:
+    static const int SMALL_K = 64;
+
+    TopKSelector() : k_(0), threshold_(std::numeric_limits<float>::infinity()) {}
+
+    // Start a new selection, keeping the capacity of the buffers.
+    void reset(int k) {
+        k_ = k;
+        entries_.clear();
+        threshold_ = k > 0 ? std::numeric_limits<float>::infinity() : -std::numeric_limits<float>::infinity();
+    }
+
+    int getK() const { return k_; }
+
+    // Candidates not below the threshold cannot enter the result. It is the k-th distance once k
+    // candidates are kept in heap mode; in buffer mode it lags behind until the next cut.
+    float getThreshold() const { return threshold_; }
+
+    // True once at least k candidates have been kept.
+    bool isFull() const { return k_ > 0 && entries_.size() >= k_; }
+
+    bool push(float distance, int id) {
+        if (!(distance < threshold_)) {
+            return false;
+        }
+        if (k_ <= SMALL_K) {
+            pushHeap(distance, id);
+        } else {
+            pushBuffer(distance, id);
+        }
+        return true;
+    }
+
+    // Linear in the kept candidates; used to drop duplicate ids, which are rare.
+    bool contains(int id) const {
+        for (const std::pair<float, int> &entry : entries_) {
+            if (entry.second == id) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Write the kept candidates as (id, distance), nearest first, ties by id.
+    // The selector must be reset before it is used again.
+    void finish(std::vector<std::pair<int, float>> &result) {
+        if (entries_.size() > k_) {
+            std::nth_element(entries_.begin(), entries_.begin() + (k_ - 1), entries_.end());
+            entries_.resize(k_);
+        }
+        std::sort(entries_.begin(), entries_.end());
+        result.clear();
+        for (const std::pair<float, int> &entry : entries_) {
+            result.push_back(std::make_pair(entry.second, entry.first));
+        }
+    }
+
+private:
+    int k_;
+    float threshold_;
+    // heap mode: max-heap on distance; buffer mode: unordered candidates
+    std::vector<std::pair<float, int>> entries_;
+
+    void pushHeap(float distance, int id) {
+        if (entries_.size() < k_) {
+            // sift up
+            size_t i = entries_.size();
+            entries_.emplace_back();
+            while (i > 0) {
+                size_t parent = (i - 1) / 2;
+                if (!(entries_[parent].first < distance)) {
+                    break;
+                }
+                entries_[i] = entries_[parent];
+                i = parent;
+            }
+            entries_[i] = std::make_pair(distance, id);
+            if (entries_.size() == k_) {
+                threshold_ = entries_[0].first;
+            }
+            return;
+        }
+        // replace the root and sift down
+        size_t size = entries_.size();
+        size_t i = 0;
+        while (true) {
+            size_t child = 2 * i + 1;
+            if (child >= size) {
+                break;
+            }
+            // pick the larger child without a branch on the comparison
+            child += child + 1 < size && entries_[child].first < entries_[child + 1].first;
+            if (!(distance < entries_[child].first)) {
+                break;
+            }
+            entries_[i] = entries_[child];
+            i = child;
+        }
+        entries_[i] = std::make_pair(distance, id);
+        threshold_ = entries_[0].first;
+    }
+
+    void pushBuffer(float distance, int id) {
+        entries_.push_back(std::make_pair(distance, id));
+        if (entries_.size() >= 2 * static_cast<size_t>(k_)) {
+            std::nth_element(entries_.begin(), entries_.begin() + (k_ - 1), entries_.end());
+            entries_.resize(k_);
+            threshold_ = entries_[k_ - 1].first;
+        }
+    }
+};
+
+#endif //TOPK_H
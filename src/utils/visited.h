@@ -0,0 +1,47 @@
+#ifndef VISITED_H
+#define VISITED_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// Visited marks for graph traversals over densely numbered slots.
+// A slot is visited when its stamp equals the current epoch, so starting a new
+// traversal is a single increment and checking a slot is one load and compare.
+// Not thread-safe; keep one table per thread.
+class VisitedTable {
+public:
+    VisitedTable() : epoch_(1) {}
+
+    // Forget all marks.
+    void reset() {
+        epoch_++;
+        if (epoch_ == 0) {
+            // wrapped around; old stamps could collide with new epochs
+            std::fill(stamps_.begin(), stamps_.end(), 0);
+            epoch_ = 1;
+        }
+    }
+
+    bool isVisited(int slot) const {
+        return slot < stamps_.size() && stamps_[slot] == epoch_;
+    }
+
+    // Mark slot as visited. Returns false if it was already visited in this epoch.
+    bool visit(int slot) {
+        if (slot >= stamps_.size()) {
+            stamps_.resize(std::max<size_t>(slot + 1, stamps_.size() * 2), 0);
+        }
+        if (stamps_[slot] == epoch_) {
+            return false;
+        }
+        stamps_[slot] = epoch_;
+        return true;
+    }
+
+private:
+    uint32_t epoch_;
+    std::vector<uint32_t> stamps_;
+};
+
+#endif //VISITED_H